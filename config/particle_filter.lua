@@ -2,3 +2,72 @@ map = "maps/GDC1.txt"
 init_x = 14.7
 init_y = 14.24
 init_r = 0
+
+-- Observation model: "raycast" or "likelihood_field".
+obs_model = "raycast"
+-- Likelihood field grid resolution and distance saturation, in meters.
+lf_resolution = 0.05
+lf_max_distance = 0.5
+
+-- Precomputed CDDT ray cast table, built in the background per map.
+use_cddt = false
+-- Lane width in meters, and number of directions over 180 degrees.
+cddt_lane_width = 0.05
+cddt_num_theta = 180
+
+-- Directory to cache the cleaned up map, and the tables derived from it, in.
+-- Cache files are keyed by a hash of the map file and the table parameters,
+-- and are only built once. Empty to disable the cache.
+map_cache_dir = "/tmp/particle_filter_map_cache"
+
+-- Threads for the predict and update steps (0: one per core), and the seed
+-- of the random number streams. Runs are reproducible for a fixed seed and
+-- thread count.
+num_threads = 0
+rng_seed = 1
+
+-- KLD-sampling: the resampled set grows up to kld_max_particles while the
+-- posterior is spread out, and shrinks to kld_min_particles when converged.
+kld_min_particles = 50
+kld_max_particles = 5000
+-- Histogram bin sizes, in meters and radians.
+kld_bin_xy = 0.2
+kld_bin_theta = 0.17
+-- KL divergence error bound, and the standard normal quantile of the
+-- confidence (2.33: 99%).
+kld_epsilon = 0.05
+kld_z = 2.33
+
+-- Resample when the effective sample size drops below this fraction of the
+-- number of particles.
+resample_ess_threshold = 0.5
+
+-- Particles within this distance (meters) and angle (radians) of each other
+-- share one predicted scan. Set to 0 to ray cast every particle.
+scan_cache_xy = 0.02
+scan_cache_theta = 0.01
+
+-- Beams scored per scan: "uniform" scores every 10th beam, "adaptive" scores
+-- beam_budget beams spread over the scan, preferring beams at corners and
+-- oblique walls, and skipping returns more than beam_max_error meters from
+-- the range expected at the current pose estimate.
+beam_selection = "uniform"
+beam_budget = 18
+beam_max_error = 1.0
+
+-- Global localization, for when the robot's location is unknown: grid
+-- resolution and likelihood width in meters, and pyramid levels (the
+-- coarsest level has cells of resolution * 2^(levels - 1)).
+global_resolution = 0.1
+global_sigma = 0.15
+global_levels = 7
+-- Scan points matched, out to global_max_range meters. Longer ranges need a
+-- finer angular search.
+global_num_points = 100
+global_max_range = 10.0
+-- Pose hypotheses seeded with particles, at least global_separation meters
+-- or radians apart, and scoring at least global_min_relative_score times the
+-- best.
+global_num_hypotheses = 10
+global_separation = 1.0
+global_min_relative_score = 0.8
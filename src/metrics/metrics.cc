@@ -0,0 +1,256 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    metrics.cc
+\brief   Always-on latency histograms and counters, and their periodic export
+         to a JSON file.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "shared/util/timer.h"
+#include "metrics.h"
+
+using std::string;
+
+namespace {
+
+// Registered metrics, by name.
+struct Registry {
+  std::mutex mutex;
+  std::map<string, std::unique_ptr<metrics::LatencyHistogram> > histograms;
+  std::map<string, std::unique_ptr<std::atomic<int64_t> > > counters;
+};
+
+Registry& GetRegistry() {
+  static Registry* registry = new Registry();
+  return *registry;
+}
+
+}  // namespace
+
+namespace metrics {
+
+LatencyHistogram::LatencyHistogram() : count_(0), sum_ns_(0), max_ns_(0) {
+  for (std::atomic<uint64_t>& b : buckets_) {
+    b.store(0, std::memory_order_relaxed);
+  }
+}
+
+uint64_t LatencyHistogram::Nanoseconds(double seconds) {
+  return static_cast<uint64_t>(std::max(0.0, seconds) * 1e9 + 0.5);
+}
+
+int LatencyHistogram::Bucket(uint64_t nanoseconds) {
+  if (nanoseconds < static_cast<uint64_t>(kSubBuckets)) return nanoseconds;
+  const int msb = 63 - __builtin_clzll(nanoseconds);
+  const int shift = msb - kSubBucketBits;
+  const int sub = (nanoseconds >> shift) & (kSubBuckets - 1);
+  return (shift + 1) * kSubBuckets + sub;
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(int bucket) {
+  if (bucket < kSubBuckets) return bucket;
+  const int shift = bucket / kSubBuckets - 1;
+  const uint64_t sub = bucket % kSubBuckets;
+  return ((kSubBuckets + sub) << shift) + (uint64_t(1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(double seconds) {
+  const uint64_t ns = Nanoseconds(seconds);
+  buckets_[Bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+  UpdateMax(ns);
+}
+
+void LatencyHistogram::UpdateMax(uint64_t nanoseconds) {
+  uint64_t max_ns = max_ns_.load(std::memory_order_relaxed);
+  while (nanoseconds > max_ns &&
+         !max_ns_.compare_exchange_weak(max_ns, nanoseconds,
+                                        std::memory_order_relaxed)) {}
+}
+
+double LatencyHistogram::Sum() const {
+  return 1e-9 * sum_ns_.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::Max() const {
+  return 1e-9 * max_ns_.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::Quantile(double q) const {
+  // The buckets may change while they are summed; the result is then off by
+  // the few latencies recorded meanwhile.
+  uint64_t total = 0;
+  for (const std::atomic<uint64_t>& b : buckets_) {
+    total += b.load(std::memory_order_relaxed);
+  }
+  if (total == 0) return 0;
+  const uint64_t rank = std::max<uint64_t>(1, ceil(q * total));
+  uint64_t sum = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    sum += buckets_[i].load(std::memory_order_relaxed);
+    if (sum >= rank) {
+      return 1e-9 * std::min(BucketUpperBound(i),
+                             max_ns_.load(std::memory_order_relaxed));
+    }
+  }
+  return Max();
+}
+
+LatencyBuffer::LatencyBuffer(LatencyHistogram* histogram) :
+    histogram_(histogram), count_(0), sum_ns_(0), max_ns_(0) {
+  std::fill(buckets_, buckets_ + LatencyHistogram::kNumBuckets, 0);
+}
+
+LatencyBuffer::~LatencyBuffer() {
+  Flush();
+}
+
+void LatencyBuffer::Record(double seconds) {
+  const uint64_t ns = LatencyHistogram::Nanoseconds(seconds);
+  ++buckets_[LatencyHistogram::Bucket(ns)];
+  ++count_;
+  sum_ns_ += ns;
+  max_ns_ = std::max(max_ns_, ns);
+}
+
+void LatencyBuffer::Flush() {
+  if (count_ == 0) return;
+  for (int i = 0; i < LatencyHistogram::kNumBuckets; ++i) {
+    if (buckets_[i] == 0) continue;
+    histogram_->buckets_[i].fetch_add(buckets_[i], std::memory_order_relaxed);
+    buckets_[i] = 0;
+  }
+  histogram_->count_.fetch_add(count_, std::memory_order_relaxed);
+  histogram_->sum_ns_.fetch_add(sum_ns_, std::memory_order_relaxed);
+  histogram_->UpdateMax(max_ns_);
+  count_ = 0;
+  sum_ns_ = 0;
+  max_ns_ = 0;
+}
+
+LatencyHistogram* GetHistogram(const string& name) {
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  std::unique_ptr<LatencyHistogram>& h = registry.histograms[name];
+  if (!h) h.reset(new LatencyHistogram());
+  return h.get();
+}
+
+std::atomic<int64_t>* GetCounter(const string& name) {
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  std::unique_ptr<std::atomic<int64_t> >& c = registry.counters[name];
+  if (!c) c.reset(new std::atomic<int64_t>(0));
+  return c.get();
+}
+
+string MetricsJSON() {
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  string json = "{\n  \"histograms\": {";
+  char buffer[512];
+  bool first = true;
+  for (const auto& it : registry.histograms) {
+    const LatencyHistogram& h = *it.second;
+    const uint64_t count = h.Count();
+    snprintf(buffer, sizeof(buffer),
+             "%s\n    \"%s\": {\"count\": %lu, \"mean_ms\": %.4f, "
+             "\"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, "
+             "\"max_ms\": %.4f}",
+             first ? "" : ",",
+             it.first.c_str(),
+             static_cast<unsigned long>(count),
+             (count > 0) ? 1e3 * h.Sum() / count : 0.0,
+             1e3 * h.Quantile(0.5),
+             1e3 * h.Quantile(0.9),
+             1e3 * h.Quantile(0.99),
+             1e3 * h.Max());
+    json += buffer;
+    first = false;
+  }
+  json += "\n  },\n  \"counters\": {";
+  first = true;
+  for (const auto& it : registry.counters) {
+    snprintf(buffer, sizeof(buffer), "%s\n    \"%s\": %ld",
+             first ? "" : ",",
+             it.first.c_str(),
+             static_cast<long>(it.second->load()));
+    json += buffer;
+    first = false;
+  }
+  json += "\n  }\n}\n";
+  return json;
+}
+
+ScopedLatency::ScopedLatency(LatencyHistogram* histogram) :
+    histogram_(histogram), t_start_(GetMonotonicTime()) {}
+
+ScopedLatency::~ScopedLatency() {
+  histogram_->Record(GetMonotonicTime() - t_start_);
+}
+
+MetricsFileWriter::MetricsFileWriter(const string& file, double period) :
+    file_(file),
+    period_(period),
+    stop_(false),
+    thread_(&MetricsFileWriter::Run, this) {}
+
+MetricsFileWriter::~MetricsFileWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+  Write();
+}
+
+void MetricsFileWriter::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    cv_.wait_for(lock, std::chrono::duration<double>(period_));
+    if (!stop_) Write();
+  }
+}
+
+void MetricsFileWriter::Write() {
+  const string json = MetricsJSON();
+  const string tmp_file = file_ + ".tmp";
+  FILE* fid = fopen(tmp_file.c_str(), "w");
+  if (fid == nullptr) {
+    fprintf(stderr, "ERROR: Unable to write metrics to %s\n",
+            tmp_file.c_str());
+    return;
+  }
+  fwrite(json.data(), 1, json.size(), fid);
+  fclose(fid);
+  rename(tmp_file.c_str(), file_.c_str());
+}
+
+}  // namespace metrics
@@ -0,0 +1,157 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    metrics.h
+\brief   Always-on latency histograms and counters, and their periodic export
+         to a JSON file.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifndef SRC_METRICS_H_
+#define SRC_METRICS_H_
+
+namespace metrics {
+
+class LatencyBuffer;
+
+// Histogram of latencies with log-spaced buckets: every power of two of
+// nanoseconds is split into kSubBuckets buckets, so a percentile is reported
+// within 1 / kSubBuckets of its value. Recording is a few relaxed atomic
+// increments, and is safe from any number of threads. Steps that run many
+// times per scan on several threads record through a LatencyBuffer instead.
+class LatencyHistogram {
+ public:
+  static const int kSubBucketBits = 3;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+  static const int kNumBuckets = 64 * kSubBuckets;
+
+  LatencyHistogram();
+
+  // Record a latency, in seconds.
+  void Record(double seconds);
+
+  // Number of latencies recorded.
+  uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+
+  // Sum and maximum of the latencies recorded, in seconds.
+  double Sum() const;
+  double Max() const;
+
+  // Upper edge of the bucket that holds the q-th quantile (q in [0, 1]) of the
+  // latencies recorded, in seconds. Returns 0 if none were recorded.
+  double Quantile(double q) const;
+
+ private:
+  friend class LatencyBuffer;
+
+  // A latency in seconds, in nanoseconds.
+  static uint64_t Nanoseconds(double seconds);
+  // Bucket of a latency, in nanoseconds.
+  static int Bucket(uint64_t nanoseconds);
+  // Largest latency in a bucket, in nanoseconds.
+  static uint64_t BucketUpperBound(int bucket);
+  // Raise the maximum to nanoseconds, if larger.
+  void UpdateMax(uint64_t nanoseconds);
+
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_ns_;
+  std::atomic<uint64_t> max_ns_;
+};
+
+// Histogram or counter registered under the given name. The first call for a
+// name creates it; it lives until the process exits. Look metrics up once,
+// e.g. into a static pointer, rather than on every use.
+LatencyHistogram* GetHistogram(const std::string& name);
+std::atomic<int64_t>* GetCounter(const std::string& name);
+
+// All registered metrics as a JSON object: histograms with their count, mean,
+// p50, p90, p99 and max in milliseconds, and counters with their value.
+std::string MetricsJSON();
+
+// Records the time from construction to destruction into a histogram.
+class ScopedLatency {
+ public:
+  explicit ScopedLatency(LatencyHistogram* histogram);
+  ~ScopedLatency();
+
+ private:
+  // Disable copy constructor.
+  ScopedLatency(const ScopedLatency&);
+
+  LatencyHistogram* const histogram_;
+  const double t_start_;
+};
+
+// Latencies recorded by one thread without atomics, and added to a histogram
+// in one go by Flush or on destruction. Used for steps timed from inside a
+// parallel loop, e.g. once per particle, where recording straight into the
+// shared histogram would have every thread contend for its cache lines.
+class LatencyBuffer {
+ public:
+  explicit LatencyBuffer(LatencyHistogram* histogram);
+  ~LatencyBuffer();
+
+  // Record a latency, in seconds.
+  void Record(double seconds);
+
+  // Add the latencies recorded since the last flush to the histogram.
+  void Flush();
+
+ private:
+  // Disable copy constructor.
+  LatencyBuffer(const LatencyBuffer&);
+
+  LatencyHistogram* const histogram_;
+  uint64_t buckets_[LatencyHistogram::kNumBuckets];
+  uint64_t count_;
+  uint64_t sum_ns_;
+  uint64_t max_ns_;
+};
+
+// Background thread that rewrites a file with MetricsJSON() periodically.
+// The file is replaced atomically, so readers never see a partial write.
+class MetricsFileWriter {
+ public:
+  MetricsFileWriter(const std::string& file, double period);
+  // Writes the file a last time, and stops the thread.
+  ~MetricsFileWriter();
+
+ private:
+  // Disable copy constructor.
+  MetricsFileWriter(const MetricsFileWriter&);
+
+  void Run();
+  void Write();
+
+  const std::string file_;
+  const double period_;
+  bool stop_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+};
+
+}  // namespace metrics
+
+#endif  // SRC_METRICS_H_
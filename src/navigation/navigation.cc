@@ -32,6 +32,7 @@
 #include "shared/util/timer.h"
 #include "shared/ros/ros_helpers.h"
 #include "navigation.h"
+#include "vector_map/map_registry.h"
 #include "visualization/visualization.h"
 #include <limits>
 
@@ -90,8 +91,9 @@ Navigation::Navigation(const string& map_file, ros::NodeHandle* n) :
   global_viz_msg_ = visualization::NewVisualizationMessage(
       "map", "navigation_global");
   InitRosHeader("base_link", &drive_msg_.header);
-  map_.Load(map_file);
-  if(map_file.empty()){
+  map_ = vector_map::GetMap(map_file);
+  if(!map_){
+    map_.reset(new vector_map::VectorMap());
     std::cout << "No Map" << std::endl;
   }
   else{
@@ -154,8 +156,8 @@ float Navigation::get_robot_angle()
   return robot_angle_;
 }
 
-void Navigation::ObservePointCloud(const vector<Vector2f>& cloud, double time) {
-  point_cloud_ = cloud;
+void Navigation::ObservePointCloud(vector<Vector2f>* cloud, double time) {
+  point_cloud_.swap(*cloud);
 }
 
 // void Navigation::calculate_distance_to_target(){
@@ -902,9 +904,9 @@ vector<line2f> Navigation::findMargins(line2f line_edge){
     line2f line_edge(node_loc, neighborLoc);
     vector<line2f> margins = findMargins(line_edge);
 
-    for (size_t i = 0; i < map_.lines.size(); ++i)
+    for (size_t i = 0; i < map_->lines.size(); ++i)
       {
-        const line2f line = map_.lines[i];
+        const line2f line = map_->lines[i];
 
         //TODO: revisit; check for correctness
         bool isCrossingCheckOne = line.Intersects(node_loc, neighborLoc);
@@ -987,7 +989,7 @@ vector<line2f> Navigation::findMargins(line2f line_edge){
     while(k > closestNodeIndex){
       Vector2f node_loc_ = path_navigation[k].loc;
 
-      if(!(map_.Intersects(current_loc, node_loc_))){
+      if(!(map_->Intersects(current_loc, node_loc_))){
         carrot = path_navigation[k];
         return carrot;
       }
@@ -31,6 +31,7 @@ length: 47 cm
 
 
 #include <vector>
+#include <memory>
 #include <iostream>
 #include<deque>
 #include <algorithm>
@@ -107,8 +108,9 @@ class Navigation {
                       const Eigen::Vector2f& vel,
                       float ang_vel);
 
-  // Updates based on an observed laser scan
-  void ObservePointCloud(const std::vector<Eigen::Vector2f>& cloud,
+  // Updates based on an observed laser scan. Takes the points of *cloud,
+  // and hands back the storage of the previous cloud in exchange.
+  void ObservePointCloud(std::vector<Eigen::Vector2f>* cloud,
                          double time);
 
   // Main function called continously from main
@@ -275,8 +277,8 @@ void drawOpenList(amrl_msgs::VisualizationMsg &msg);
     bool DESTINATION_REACHED = false;
     Eigen::Vector2f destinationLoc;
     Eigen::Matrix2f rotateMaptoBase;
-    // Map of the environment.
-    vector_map::VectorMap map_;
+    // Map of the environment, shared read-only through the map registry.
+    std::shared_ptr<const vector_map::VectorMap> map_;
     bool found_path;
     bool found_target; 
   /*****************************************************/
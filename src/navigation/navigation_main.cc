@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <memory>
 #include <vector>
 
 #include "glog/logging.h"
@@ -45,6 +46,7 @@
 #include "shared/math/math_util.h"
 #include "shared/util/timer.h"
 #include "shared/ros/ros_helpers.h"
+#include "scan_geometry/beam_directions.h"
 
 #include "navigation.h"
 
@@ -71,10 +73,11 @@ DEFINE_string(init_topic,
 DEFINE_string(map, "maps/GDC1.txt", "Name of vector map file");
 
 bool run_ = true;
-sensor_msgs::LaserScan last_laser_msg_;
+sensor_msgs::LaserScan::ConstPtr last_laser_msg_;
 Navigation* navigation_ = nullptr;
 
-void LaserCallback(const sensor_msgs::LaserScan& msg) {
+void LaserCallback(const sensor_msgs::LaserScan::ConstPtr& msg_ptr) {
+  const sensor_msgs::LaserScan& msg = *msg_ptr;
   if (FLAGS_v > 0) {
     printf("Laser t=%f, dt=%f\n",
            msg.header.stamp.toSec(),
@@ -84,23 +87,22 @@ void LaserCallback(const sensor_msgs::LaserScan& msg) {
   const Vector2f kLaserLoc(0.2, 0);
 
 
+  // Point cloud buffer, swapped with the one navigation_ holds on every
+  // scan, so that neither is copied or reallocated.
   static vector<Vector2f> point_cloud_;
-  // TODO Convert the LaserScan to a point cloud
-
-
-  point_cloud_.clear();
-
-  float angle_iter = msg.angle_min, range;
-  int i=0;
-
-  while (angle_iter <= msg.angle_max) {
-    range = msg.ranges.at(i);
-    point_cloud_.push_back( Vector2f { kLaserLoc[0] + range * cos(angle_iter), kLaserLoc[1] + range * sin(angle_iter)} );
-    i++;
-    angle_iter += msg.angle_increment;
+  // Beam directions, looked up again only when the scan geometry changes.
+  static std::shared_ptr<const scan_geometry::BeamDirections> directions_;
+  const int num_ranges = msg.ranges.size();
+  const scan_geometry::BeamDirections& directions =
+      scan_geometry::UpdateBeamDirections(
+          msg.angle_min, msg.angle_min + num_ranges * msg.angle_increment,
+          num_ranges, &directions_);
+  point_cloud_.resize(num_ranges);
+  for (int i = 0; i < num_ranges; ++i) {
+    point_cloud_[i] = kLaserLoc + msg.ranges[i] * directions.Direction(i);
   }
-  navigation_->ObservePointCloud(point_cloud_, msg.header.stamp.toSec());
-  last_laser_msg_ = msg;
+  navigation_->ObservePointCloud(&point_cloud_, msg.header.stamp.toSec());
+  last_laser_msg_ = msg_ptr;
 
 }
 
@@ -0,0 +1,54 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    beam_model.cc
+\brief   Truncated Gaussian laser beam model, scored in log space.
+*/
+//========================================================================
+
+#include <cstddef>
+
+#include "beam_model.h"
+
+namespace particle_filter {
+
+float ScoreBeams(const BeamModel& model,
+                 const float* observed,
+                 const float* expected,
+                 size_t n,
+                 float range_min,
+                 float range_max) {
+  const float* __restrict__ r = observed;
+  const float* __restrict__ d = expected;
+  const float neg_inv_var = model.neg_inv_var;
+  const float lo = -model.max_long_error;
+  const float hi = model.max_short_error;
+  // The truncation is a clamp of the range error, and invalid beams are
+  // masked out, so the loop has no branches and vectorizes. The conditional
+  // expressions compile to vector selects.
+  float sum = 0;
+  #pragma omp simd reduction(+:sum)
+  for (size_t i = 0; i < n; ++i) {
+    float e = d[i] - r[i];
+    e = (e < lo) ? lo : e;
+    e = (e > hi) ? hi : e;
+    float valid = (r[i] < range_min) ? 0.0f : 1.0f;
+    valid = (r[i] > range_max) ? 0.0f : valid;
+    sum += valid * e * e;
+  }
+  return model.gamma * neg_inv_var * sum;
+}
+
+}  // namespace particle_filter
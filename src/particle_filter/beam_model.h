@@ -0,0 +1,65 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    beam_model.h
+\brief   Truncated Gaussian laser beam model, scored in log space.
+*/
+//========================================================================
+
+#include <cstddef>
+
+#ifndef SRC_BEAM_MODEL_H_
+#define SRC_BEAM_MODEL_H_
+
+namespace particle_filter {
+
+// Parameters of the truncated Gaussian beam model, precomputed once per scan.
+// A beam with observed range r and expected range d scores
+//   -min(max(d - r, -long_distance), short_distance)^2 / var_obs^2,
+// i.e. a Gaussian in the range error whose penalty saturates for beams that
+// are much shorter (e.g. occluded by people) or much longer than expected.
+struct BeamModel {
+  BeamModel(float var_obs,
+            float short_distance,
+            float long_distance,
+            float gamma) :
+      neg_inv_var(-1.0f / (var_obs * var_obs)),
+      max_short_error(short_distance),
+      max_long_error(long_distance),
+      gamma(gamma) {}
+
+  // -1 / var_obs^2.
+  float neg_inv_var;
+  // Largest range error counted for beams shorter than expected.
+  float max_short_error;
+  // Largest range error counted for beams longer than expected.
+  float max_long_error;
+  // Scale of the summed log likelihood, to account for correlated beams.
+  float gamma;
+};
+
+// Log likelihood of a scan, scaled by gamma. observed and expected hold the
+// n observed and expected ranges of the scored beams. Observed ranges outside
+// [range_min, range_max] are ignored.
+float ScoreBeams(const BeamModel& model,
+                 const float* observed,
+                 const float* expected,
+                 size_t n,
+                 float range_min,
+                 float range_max);
+
+}  // namespace particle_filter
+
+#endif  // SRC_BEAM_MODEL_H_
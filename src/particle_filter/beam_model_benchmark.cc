@@ -0,0 +1,139 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    beam_model_benchmark.cc
+\brief   Micro-benchmark of the beam model kernel against the per-beam
+         exp / log loop it replaced.
+*/
+//========================================================================
+
+#include <stdio.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/util/timer.h"
+#include "particle_filter/beam_model.h"
+#include "particle_filter/particle_set.h"
+
+using Eigen::Vector2f;
+using particle_filter::AlignedVector;
+using particle_filter::BeamModel;
+using particle_filter::ScoreBeams;
+using std::vector;
+
+namespace {
+
+const float kVarObs = 0.5;
+const float kShortDistance = 0.5;
+const float kLongDistance = 0.5;
+const float kGamma = 1.0;
+const float kRangeMin = 0.02;
+const float kRangeMax = 10.0;
+
+// The previous scoring loop of ParticleFilter::Update, operating on the
+// predicted point cloud.
+double ScoreBeamsReference(const vector<float>& ranges,
+                           const vector<Vector2f>& predicted,
+                           const Vector2f& lazer_loc) {
+  double log_prob = 0;
+  double prob = 0;
+  for (size_t i = 0; i < predicted.size(); i++) {
+    const double distance = sqrt(pow(predicted[i].x() - lazer_loc.x(), 2) +
+                                 pow(predicted[i].y() - lazer_loc.y(), 2));
+    if (ranges[i] < kRangeMin) {
+      continue;
+    } else if (ranges[i] > kRangeMax) {
+      continue;
+    } else if (ranges[i] < distance - kShortDistance) {
+      prob = exp(-(kShortDistance * kShortDistance) / (kVarObs * kVarObs));
+    } else if (ranges[i] > distance + kLongDistance) {
+      prob = exp(-(kLongDistance * kLongDistance) / (kVarObs * kVarObs));
+    } else {
+      prob = exp(-(pow(distance - ranges[i], 2)) / (kVarObs * kVarObs));
+    }
+    log_prob += log(prob);
+  }
+  return kGamma * log_prob;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int kNumBeams = 108;
+  const int kNumScans = 2000;
+  const int kRepeats = 50;
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> range_dist(0, 11);
+  std::normal_distribution<float> error_dist(0, 0.4);
+  std::uniform_real_distribution<float> angle_dist(-M_PI, M_PI);
+
+  // Random scans: observed ranges, some of them invalid, and predicted
+  // points near them, as seen from a random laser location.
+  const Vector2f lazer_loc(3, -2);
+  vector<vector<float> > observed(kNumScans);
+  vector<vector<Vector2f> > predicted(kNumScans);
+  vector<AlignedVector<float> > observed_flat(kNumScans);
+  vector<AlignedVector<float> > expected_flat(kNumScans);
+  for (int s = 0; s < kNumScans; ++s) {
+    for (int i = 0; i < kNumBeams; ++i) {
+      const float r = range_dist(gen);
+      const float d = std::max(0.0f, r + error_dist(gen));
+      const float a = angle_dist(gen);
+      observed[s].push_back(r);
+      predicted[s].push_back(lazer_loc + d * Vector2f(cos(a), sin(a)));
+      observed_flat[s].push_back(r);
+      expected_flat[s].push_back((predicted[s].back() - lazer_loc).norm());
+    }
+  }
+
+  const BeamModel model(kVarObs, kShortDistance, kLongDistance, kGamma);
+  double max_error = 0;
+  for (int s = 0; s < kNumScans; ++s) {
+    const double a = ScoreBeamsReference(observed[s], predicted[s], lazer_loc);
+    const double b = ScoreBeams(model, observed_flat[s].data(),
+        expected_flat[s].data(), kNumBeams, kRangeMin, kRangeMax);
+    max_error = std::max(max_error, fabs(a - b) / std::max(1.0, fabs(a)));
+  }
+
+  double checksum = 0;
+  double t_start = GetMonotonicTime();
+  for (int k = 0; k < kRepeats; ++k) {
+    for (int s = 0; s < kNumScans; ++s) {
+      checksum += ScoreBeamsReference(observed[s], predicted[s], lazer_loc);
+    }
+  }
+  const double t_reference = GetMonotonicTime() - t_start;
+
+  t_start = GetMonotonicTime();
+  for (int k = 0; k < kRepeats; ++k) {
+    for (int s = 0; s < kNumScans; ++s) {
+      checksum += ScoreBeams(model, observed_flat[s].data(),
+          expected_flat[s].data(), kNumBeams, kRangeMin, kRangeMax);
+    }
+  }
+  const double t_kernel = GetMonotonicTime() - t_start;
+
+  const double num_evaluated = static_cast<double>(kRepeats) * kNumScans;
+  printf("Beams per scan: %d, scans scored: %.0f\n", kNumBeams, num_evaluated);
+  printf("Reference loop: %8.1f ns/scan\n", 1e9 * t_reference / num_evaluated);
+  printf("Kernel:         %8.1f ns/scan (%.1fx)\n",
+         1e9 * t_kernel / num_evaluated, t_reference / t_kernel);
+  printf("Max relative difference: %g (checksum %g)\n", max_error, checksum);
+  return 0;
+}
@@ -0,0 +1,84 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    beam_selection.cc
+\brief   Per-scan choice of the laser beams scored by the observation model.
+*/
+//========================================================================
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "beam_selection.h"
+
+using std::vector;
+
+namespace particle_filter {
+
+void SelectBeams(const float* observed,
+                 const float* expected,
+                 size_t n,
+                 float range_min,
+                 float range_max,
+                 float angle_increment,
+                 float max_error,
+                 size_t budget,
+                 vector<int>* beams) {
+  beams->clear();
+  if (n == 0 || budget == 0) return;
+
+  // Candidate beams, with and without the outlier test. The buffer keeps its
+  // storage between scans.
+  static thread_local vector<int> candidates;
+  candidates.clear();
+  for (int pass = 0; pass < 2 && candidates.size() < budget; ++pass) {
+    candidates.clear();
+    for (size_t i = 0; i < n; ++i) {
+      if (observed[i] <= range_min || observed[i] >= range_max) continue;
+      if (expected[i] >= range_max) continue;
+      if (pass == 0 && fabs(observed[i] - expected[i]) > max_error) continue;
+      candidates.push_back(i);
+    }
+  }
+  if (candidates.size() <= budget) {
+    *beams = candidates;
+    return;
+  }
+
+  // Keep the most informative beam of each run of candidates.
+  const size_t num_candidates = candidates.size();
+  for (size_t k = 0; k < budget; ++k) {
+    const size_t begin = num_candidates * k / budget;
+    const size_t end = num_candidates * (k + 1) / budget;
+    int best = candidates[begin];
+    float best_score = -1;
+    for (size_t c = begin; c < end; ++c) {
+      const int i = candidates[c];
+      const int prev = (i > 0) ? i - 1 : i;
+      const int next = (i + 1 < static_cast<int>(n)) ? i + 1 : i;
+      const float score = (next > prev) ?
+          fabs(expected[next] - expected[prev]) /
+          ((next - prev) * angle_increment * expected[i]) : 0.0f;
+      if (score > best_score) {
+        best = i;
+        best_score = score;
+      }
+    }
+    beams->push_back(best);
+  }
+}
+
+}  // namespace particle_filter
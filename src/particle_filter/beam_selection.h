@@ -0,0 +1,56 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    beam_selection.h
+\brief   Per-scan choice of the laser beams scored by the observation model.
+*/
+//========================================================================
+
+#include <cstddef>
+#include <vector>
+
+#ifndef SRC_BEAM_SELECTION_H_
+#define SRC_BEAM_SELECTION_H_
+
+namespace particle_filter {
+
+// Choose up to budget beams of a scan of n beams to score, once per scan for
+// all particles. observed holds the observed ranges, and expected the ranges
+// predicted from the current pose estimate, for beams angle_increment apart.
+//
+// Beams with an observed range outside (range_min, range_max), an expected
+// range of range_max, or an observed range more than max_error from the
+// expected one (e.g. people, or unmapped objects) are skipped. If that leaves
+// fewer than budget beams, e.g. because the pose estimate is off, the
+// max_error test is dropped. The remaining beams are split into budget runs of
+// consecutive beams, so that every part of the scan, and so every map segment
+// in view, is represented. From each run, the beam with the largest relative
+// expected-range gradient |dr / dtheta| / r is kept: beams that hit walls at
+// an angle, or corners, constrain the pose more than beams that hit a wall
+// head-on. The indices of the kept beams are written to beams, in increasing
+// order.
+void SelectBeams(const float* observed,
+                 const float* expected,
+                 size_t n,
+                 float range_min,
+                 float range_max,
+                 float angle_increment,
+                 float max_error,
+                 size_t budget,
+                 std::vector<int>* beams);
+
+}  // namespace particle_filter
+
+#endif  // SRC_BEAM_SELECTION_H_
@@ -0,0 +1,77 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    beam_selection_test.cc
+\brief   Checks that SelectBeams chooses the beams of each scan afresh when
+         called for successive scans.
+*/
+//========================================================================
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "particle_filter/beam_selection.h"
+
+using particle_filter::SelectBeams;
+using std::vector;
+
+namespace {
+
+const float kRangeMin = 0.02;
+const float kRangeMax = 10;
+const float kAngleIncrement = 0.005;
+const float kMaxError = 0.5;
+const size_t kBudget = 10;
+
+// Select the beams of a scan whose beams [first_valid, n) see a wall 5 m away,
+// and the others nothing. Returns the number of errors found.
+int CheckScan(const char* name, size_t n, size_t first_valid) {
+  vector<float> observed(n, kRangeMax);
+  vector<float> expected(n, 5);
+  for (size_t i = first_valid; i < n; ++i) {
+    observed[i] = 5;
+  }
+  vector<int> beams;
+  SelectBeams(observed.data(), expected.data(), n, kRangeMin, kRangeMax,
+              kAngleIncrement, kMaxError, kBudget, &beams);
+  int errors = 0;
+  if (beams.size() != kBudget) {
+    printf("%s: %d beams selected, expected %d\n", name,
+           static_cast<int>(beams.size()), static_cast<int>(kBudget));
+    ++errors;
+  }
+  for (const int i : beams) {
+    if (i < static_cast<int>(first_valid) || i >= static_cast<int>(n)) {
+      printf("%s: beam %d selected, outside [%d, %d)\n", name, i,
+             static_cast<int>(first_valid), static_cast<int>(n));
+      ++errors;
+    }
+  }
+  return errors;
+}
+
+}  // namespace
+
+int main() {
+  int errors = 0;
+  errors += CheckScan("full scan", 200, 0);
+  // Beams 0..90 now see nothing, and must not be kept from the last scan.
+  errors += CheckScan("partly empty scan", 200, 91);
+  // A shorter scan must not select beams past its end.
+  errors += CheckScan("short scan", 50, 0);
+  printf("%s\n", (errors == 0) ? "PASS" : "FAIL");
+  return (errors == 0) ? 0 : 1;
+}
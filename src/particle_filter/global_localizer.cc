@@ -0,0 +1,389 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    global_localizer.cc
+\brief   Global localization by multi-resolution correlative scan matching
+         against a vector map.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "shared/math/math_util.h"
+#include "shared/util/timer.h"
+#include "vector_map/distance_field.h"
+#include "vector_map/map_cache.h"
+#include "global_localizer.h"
+
+using geometry::line2f;
+using math_util::AngleDiff;
+using math_util::AngleMod;
+using std::string;
+using vector_map::CacheReader;
+using vector_map::CacheWriter;
+using std::vector;
+using Eigen::Vector2f;
+
+namespace particle_filter {
+
+namespace {
+
+// A window of laser positions at one level of the pyramid, for one
+// orientation: cells [x, x + 2^level) by [y, y + 2^level).
+struct Candidate {
+  int x;
+  int y;
+  int level;
+  // Upper bound on the summed likelihood of every position in the window,
+  // and the exact sum at level 0.
+  float score;
+};
+
+bool LowerScore(const Candidate& a, const Candidate& b) {
+  return a.score < b.score;
+}
+
+bool HigherScore(const PoseHypothesis& a, const PoseHypothesis& b) {
+  return a.score > b.score;
+}
+
+// Add h to the best-first list of up to max_size hypotheses, unless a better
+// hypothesis within min_separation is already in it. A worse one within
+// min_separation is replaced.
+void AddHypothesis(const PoseHypothesis& h,
+                   size_t max_size,
+                   float min_separation,
+                   vector<PoseHypothesis>* list) {
+  for (PoseHypothesis& other : *list) {
+    if ((other.loc - h.loc).norm() < min_separation &&
+        fabs(AngleDiff(other.angle, h.angle)) < min_separation) {
+      if (h.score > other.score) {
+        other = h;
+        std::sort(list->begin(), list->end(), HigherScore);
+      }
+      return;
+    }
+  }
+  list->push_back(h);
+  std::sort(list->begin(), list->end(), HigherScore);
+  if (list->size() > max_size) list->pop_back();
+}
+
+}  // namespace
+
+GlobalLocalizer::GlobalLocalizer() :
+    resolution_(0),
+    sigma_(0),
+    max_range_(0),
+    origin_(0, 0),
+    width_(0),
+    height_(0),
+    map_width_(0),
+    map_height_(0),
+    margin_(0) {}
+
+bool GlobalLocalizer::BuiltFor(const string& map_file,
+                               float resolution,
+                               float sigma,
+                               int num_levels,
+                               float max_range) const {
+  return !Empty() &&
+      map_file == map_file_ &&
+      resolution == resolution_ &&
+      sigma == sigma_ &&
+      num_levels == static_cast<int>(levels_.size()) &&
+      max_range == max_range_;
+}
+
+void GlobalLocalizer::Build(const vector_map::VectorMap& map,
+                            float resolution,
+                            float sigma,
+                            int num_levels,
+                            float max_range) {
+  static CumulativeFunctionTimer function_timer_(__FUNCTION__);
+  CumulativeFunctionTimer::Invocation invoke(&function_timer_);
+  map_file_ = map.file_name;
+  resolution_ = resolution;
+  sigma_ = sigma;
+  max_range_ = max_range;
+  levels_.clear();
+  width_ = height_ = 0;
+  map_width_ = map_height_ = margin_ = 0;
+  if (map.lines.empty() || resolution <= 0 || sigma <= 0 || num_levels <= 0 ||
+      max_range <= 0) {
+    return;
+  }
+
+  Vector2f p_min = map.lines[0].p0;
+  Vector2f p_max = map.lines[0].p0;
+  for (const line2f& l : map.lines) {
+    p_min = p_min.cwiseMin(l.p0).cwiseMin(l.p1);
+    p_max = p_max.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  // The laser positions searched are the cells of the map's bounding box.
+  // The grid extends beyond them by a margin of max_range, so that the scan
+  // points of every position searched fall in the grid.
+  map_width_ = static_cast<int>(ceil((p_max.x() - p_min.x()) / resolution));
+  map_height_ = static_cast<int>(ceil((p_max.y() - p_min.y()) / resolution));
+  margin_ = static_cast<int>(ceil(max_range / resolution)) + 1;
+  origin_ = p_min - resolution * Vector2f(margin_, margin_);
+  width_ = map_width_ + 2 * margin_;
+  height_ = map_height_ + 2 * margin_;
+
+  // Level 0: the likelihood at the center of every cell, scaled to 0-255 so
+  // that more of the grid fits in the cache. Beyond 3 sigma the likelihood
+  // is negligible, so the distance field saturates there.
+  vector_map::DistanceField distance_field;
+  distance_field.Build(map, resolution, 3.0f * sigma);
+  levels_.resize(num_levels);
+  vector<uint8_t>& level0 = levels_[0];
+  level0.resize(width_ * height_);
+  const float neg_inv_two_var = -1.0f / (2.0f * sigma * sigma);
+  for (int y = 0; y < height_; ++y) {
+    for (int x = 0; x < width_; ++x) {
+      const float d = distance_field.Distance(
+          origin_ + resolution * Vector2f(x + 0.5f, y + 0.5f));
+      level0[y * width_ + x] =
+          static_cast<uint8_t>(lrint(255.0f * exp(d * d * neg_inv_two_var)));
+    }
+  }
+
+  // Level k is the maximum of two shifted copies of level k - 1, first along
+  // x, then along y. Likelihoods are non-negative, so cells beyond the grid
+  // count as zero.
+  for (int k = 1; k < num_levels; ++k) {
+    const int h = 1 << (k - 1);
+    const vector<uint8_t>& prev = levels_[k - 1];
+    vector<uint8_t>& level = levels_[k];
+    level.resize(width_ * height_);
+    for (int y = 0; y < height_; ++y) {
+      for (int x = 0; x < width_; ++x) {
+        const int i = y * width_ + x;
+        level[i] = (x + h < width_) ? std::max(prev[i], prev[i + h]) : prev[i];
+      }
+    }
+    for (int y = 0; y + h < height_; ++y) {
+      for (int x = 0; x < width_; ++x) {
+        const int i = y * width_ + x;
+        level[i] = std::max(level[i], level[i + h * width_]);
+      }
+    }
+  }
+}
+
+// Version of the cache file format, to bump whenever it changes.
+static const uint32_t kGlobalLocalizerCacheVersion = 1;
+
+bool GlobalLocalizer::SaveCache(const string& cache_file) const {
+  CacheWriter writer("global_localizer", kGlobalLocalizerCacheVersion);
+  writer.Write(resolution_);
+  writer.Write(sigma_);
+  writer.Write(max_range_);
+  writer.Write(origin_.x());
+  writer.Write(origin_.y());
+  writer.Write(map_width_);
+  writer.Write(map_height_);
+  writer.Write(margin_);
+  writer.Write<uint64_t>(levels_.size());
+  for (const vector<uint8_t>& level : levels_) {
+    writer.WriteArray(level);
+  }
+  return writer.Save(cache_file);
+}
+
+bool GlobalLocalizer::LoadCache(const string& cache_file,
+                                const string& map_file) {
+  static CumulativeFunctionTimer function_timer_(__FUNCTION__);
+  CumulativeFunctionTimer::Invocation invoke(&function_timer_);
+  CacheReader reader;
+  float resolution = 0, sigma = 0, max_range = 0, origin_x = 0, origin_y = 0;
+  int map_width = 0, map_height = 0, margin = 0;
+  uint64_t num_levels = 0;
+  if (!reader.Open(cache_file, "global_localizer",
+                   kGlobalLocalizerCacheVersion) ||
+      !reader.Read(&resolution) ||
+      !reader.Read(&sigma) ||
+      !reader.Read(&max_range) ||
+      !reader.Read(&origin_x) ||
+      !reader.Read(&origin_y) ||
+      !reader.Read(&map_width) ||
+      !reader.Read(&map_height) ||
+      !reader.Read(&margin) ||
+      !reader.Read(&num_levels) ||
+      resolution <= 0 || map_width < 0 || map_height < 0 ||
+      margin < static_cast<int>(ceil(max_range / resolution)) + 1 ||
+      num_levels == 0 || num_levels > 32) {
+    return false;
+  }
+  // Search relies on the margin to skip bounds checks, so every level must
+  // cover it.
+  const int width = map_width + 2 * margin;
+  const int height = map_height + 2 * margin;
+  vector<vector<uint8_t> > levels(num_levels);
+  for (vector<uint8_t>& level : levels) {
+    if (!reader.ReadArray(&level) ||
+        level.size() != static_cast<size_t>(width) * height) {
+      return false;
+    }
+  }
+  if (!reader.Done()) return false;
+  map_file_ = map_file;
+  resolution_ = resolution;
+  sigma_ = sigma;
+  max_range_ = max_range;
+  origin_ = Vector2f(origin_x, origin_y);
+  width_ = width;
+  height_ = height;
+  map_width_ = map_width;
+  map_height_ = map_height;
+  margin_ = margin;
+  levels_.swap(levels);
+  return true;
+}
+
+float GlobalLocalizer::AngleStep(const vector<Vector2f>& points) const {
+  float max_range = 0;
+  for (const Vector2f& p : points) {
+    max_range = std::max(max_range, p.norm());
+  }
+  if (max_range <= resolution_) return M_PI / 4;
+  return acos(1.0f - resolution_ * resolution_ /
+              (2.0f * max_range * max_range));
+}
+
+void GlobalLocalizer::Search(const vector<Vector2f>& scan_points,
+                             size_t num_hypotheses,
+                             float min_separation,
+                             float min_relative_score,
+                             int num_threads,
+                             vector<PoseHypothesis>* hypotheses) const {
+  static CumulativeFunctionTimer function_timer_(__FUNCTION__);
+  CumulativeFunctionTimer::Invocation invoke(&function_timer_);
+  hypotheses->clear();
+  vector<Vector2f> points;
+  for (const Vector2f& p : scan_points) {
+    if (p.norm() <= max_range_) points.push_back(p);
+  }
+  if (Empty() || points.empty() || num_hypotheses == 0) return;
+  const int num_angles =
+      static_cast<int>(ceil(2.0 * M_PI / AngleStep(points)));
+  const float angle_step = 2.0 * M_PI / num_angles;
+  const int top_level = levels_.size() - 1;
+  const int num_points = points.size();
+
+  // Lowest score a window needs to hold one of the best hypotheses. Every
+  // thread raises it to the worst score in its own full list of hypotheses,
+  // and to min_relative_score times its best score.
+  std::atomic<float> threshold(0);
+  std::mutex result_mutex;
+
+  #pragma omp parallel num_threads(num_threads)
+  {
+    vector<PoseHypothesis> best;
+    vector<Candidate> stack;
+    vector<Candidate> children;
+
+    vector<int> offsets(num_points);
+
+    // Sum over the points of the level's grid, with the laser at cell
+    // (x, y). The margin of the grid keeps every point inside it.
+    auto score = [&](int level, int x, int y) {
+      const uint8_t* cell = levels_[level].data() + y * width_ + x;
+      int sum = 0;
+      for (int i = 0; i < num_points; ++i) {
+        sum += cell[offsets[i]];
+      }
+      return static_cast<float>(sum);
+    };
+
+    #pragma omp for schedule(dynamic, 1)
+    for (int a = 0; a < num_angles; ++a) {
+      const float angle = a * angle_step;
+      const Eigen::Rotation2Df rotation(angle);
+      for (int i = 0; i < num_points; ++i) {
+        const Vector2f p = rotation * points[i] / resolution_;
+        offsets[i] = static_cast<int>(round(p.y())) * width_ +
+            static_cast<int>(round(p.x()));
+      }
+
+      // Windows of the top level that tile the map, searched depth first,
+      // best window first.
+      stack.clear();
+      const int top_size = 1 << top_level;
+      for (int y = margin_; y < margin_ + map_height_; y += top_size) {
+        for (int x = margin_; x < margin_ + map_width_; x += top_size) {
+          stack.push_back({x, y, top_level, score(top_level, x, y)});
+        }
+      }
+      std::sort(stack.begin(), stack.end(), LowerScore);
+      while (!stack.empty()) {
+        const Candidate c = stack.back();
+        stack.pop_back();
+        if (c.score <= threshold) continue;
+        if (c.level == 0) {
+          PoseHypothesis h;
+          h.loc = origin_ + resolution_ * Vector2f(c.x + 0.5f, c.y + 0.5f);
+          h.angle = AngleMod(angle);
+          h.score = c.score;
+          AddHypothesis(h, num_hypotheses, min_separation, &best);
+          float bound = min_relative_score * best.front().score;
+          if (best.size() == num_hypotheses) {
+            bound = std::max(bound, best.back().score);
+          }
+          float t = threshold;
+          while (bound > t && !threshold.compare_exchange_weak(t, bound)) {}
+          continue;
+        }
+        const int level = c.level - 1;
+        const int h = 1 << level;
+        children.clear();
+        for (int dy = 0; dy <= h; dy += h) {
+          for (int dx = 0; dx <= h; dx += h) {
+            const int x = c.x + dx;
+            const int y = c.y + dy;
+            if (x >= margin_ + map_width_ || y >= margin_ + map_height_) {
+              continue;
+            }
+            const float s = score(level, x, y);
+            if (s > threshold) children.push_back({x, y, level, s});
+          }
+        }
+        std::sort(children.begin(), children.end(), LowerScore);
+        stack.insert(stack.end(), children.begin(), children.end());
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(result_mutex);
+    for (const PoseHypothesis& h : best) {
+      AddHypothesis(h, num_hypotheses, min_separation, hypotheses);
+    }
+  }
+
+  for (PoseHypothesis& h : *hypotheses) {
+    h.score /= 255.0f * num_points;
+  }
+}
+
+}  // namespace particle_filter
@@ -0,0 +1,120 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    global_localizer.h
+\brief   Global localization by multi-resolution correlative scan matching
+         against a vector map.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "vector_map/vector_map.h"
+
+#ifndef SRC_GLOBAL_LOCALIZER_H_
+#define SRC_GLOBAL_LOCALIZER_H_
+
+namespace particle_filter {
+
+// A laser pose found by the global search, and its score: the mean
+// likelihood of the scan points, in [0, 1].
+struct PoseHypothesis {
+  Eigen::Vector2f loc;
+  float angle;
+  float score;
+};
+
+// Finds the laser poses that best explain a scan anywhere in a map, with the
+// branch and bound correlative scan matcher of Hess et al. (2016). Level 0 of
+// a pyramid of grids holds the likelihood exp(-d^2 / (2 sigma^2)) of a point
+// at distance d from the closest map line. Cell (x, y) of level k holds the
+// largest level 0 value in the 2^k by 2^k window at (x, y), so the score of
+// a scan at level k bounds the score of every position in the window. The
+// search walks down the pyramid for every scan orientation, and skips every
+// window whose bound is below the best scores found so far.
+class GlobalLocalizer {
+ public:
+  GlobalLocalizer();
+
+  // Build the likelihood pyramid for the map, with num_levels levels of
+  // resolution-sized cells, for scan points up to max_range from the laser.
+  void Build(const vector_map::VectorMap& map,
+             float resolution,
+             float sigma,
+             int num_levels,
+             float max_range);
+
+  // Returns true if the pyramid was built for the given map and parameters.
+  bool BuiltFor(const std::string& map_file,
+                float resolution,
+                float sigma,
+                int num_levels,
+                float max_range) const;
+
+  // Write the pyramid to a cache file, see vector_map/map_cache.h, or read
+  // it back as built from map_file. Return false on failure; a failed load
+  // leaves the pyramid unchanged.
+  bool SaveCache(const std::string& cache_file) const;
+  bool LoadCache(const std::string& cache_file, const std::string& map_file);
+
+  bool Empty() const { return levels_.empty(); }
+
+  // Search every position and orientation in the map for the laser poses
+  // that best explain the scan points, given in the laser frame. Points
+  // beyond the max_range of the pyramid are ignored. Up to num_hypotheses
+  // poses are returned, best first, no two of them closer than
+  // min_separation meters with headings within min_separation radians, and
+  // none scoring below min_relative_score times the best. The orientations
+  // are searched in parallel on num_threads threads.
+  void Search(const std::vector<Eigen::Vector2f>& scan_points,
+              size_t num_hypotheses,
+              float min_separation,
+              float min_relative_score,
+              int num_threads,
+              std::vector<PoseHypothesis>* hypotheses) const;
+
+  // Angular step of the search for the given scan points, in radians: the
+  // rotation that moves the farthest point by one cell.
+  float AngleStep(const std::vector<Eigen::Vector2f>& points) const;
+
+ private:
+  // Name of the map file the pyramid was built from.
+  std::string map_file_;
+  // Size of a grid cell, in meters.
+  float resolution_;
+  float sigma_;
+  float max_range_;
+  // Location of the corner of cell (0, 0).
+  Eigen::Vector2f origin_;
+  // Grid dimensions, in cells. All levels have the same dimensions.
+  int width_;
+  int height_;
+  // Dimensions of the map's bounding box, and the margin around it, in
+  // cells.
+  int map_width_;
+  int map_height_;
+  int margin_;
+  // Row-major likelihood grids, one per level, scaled to 0-255.
+  std::vector<std::vector<uint8_t> > levels_;
+};
+
+}  // namespace particle_filter
+
+#endif  // SRC_GLOBAL_LOCALIZER_H_
@@ -0,0 +1,100 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    latest_mailbox.h
+\brief   Single-slot mailbox where the latest message wins.
+*/
+//========================================================================
+
+#include <atomic>
+#include <utility>
+
+#ifndef SRC_LATEST_MAILBOX_H_
+#define SRC_LATEST_MAILBOX_H_
+
+namespace particle_filter {
+
+// Hands messages from a producer thread to a consumer thread through a single
+// slot. Posting replaces any message that has not been taken yet, so a slow
+// consumer always gets the most recent message and never works through a
+// backlog. Messages are held by value: small structs, or shared pointers to
+// immutable messages such as ROS ConstPtrs, so passing one through the
+// mailbox neither copies the message nor allocates.
+//
+// The mailbox is a triple buffer: the producer fills its back slot, the
+// consumer reads its front slot, and the two trade slots with the middle one
+// by a single atomic exchange of its index, so Post and Take are wait-free.
+// Post and Clear must be called from one producer thread, and Take from one
+// consumer thread.
+template <typename T>
+class LatestMailbox {
+ public:
+  LatestMailbox() : back_(0), middle_(1), front_(2) {}
+
+  // Post a message. Returns true if it replaced an unread message.
+  bool Post(T message) {
+    std::swap(slots_[back_], message);
+    const int old = middle_.exchange(back_ | kFresh,
+                                     std::memory_order_acq_rel);
+    back_ = old & kIndex;
+    // Release the replaced message, if any.
+    slots_[back_] = T();
+    return (old & kFresh) != 0;
+  }
+
+  // Take the latest message into *message. Returns false, leaving *message
+  // unchanged, if there is none.
+  bool Take(T* message) {
+    if ((middle_.load(std::memory_order_acquire) & kFresh) == 0) return false;
+    const int old = middle_.exchange(front_, std::memory_order_acq_rel);
+    front_ = old & kIndex;
+    // A Clear between the load and the exchange leaves nothing to take.
+    if ((old & kFresh) == 0) return false;
+    std::swap(*message, slots_[front_]);
+    slots_[front_] = T();
+    return true;
+  }
+
+  // Drop any unread message. It is released by the next Post.
+  void Clear() {
+    middle_.fetch_and(kIndex, std::memory_order_acq_rel);
+  }
+
+  // Whether there is no unread message. Only a snapshot: a concurrent Post or
+  // Take may change it right after.
+  bool Empty() const {
+    return (middle_.load(std::memory_order_acquire) & kFresh) == 0;
+  }
+
+ private:
+  LatestMailbox(const LatestMailbox&) = delete;
+  LatestMailbox& operator=(const LatestMailbox&) = delete;
+
+  // The middle index holds a slot index, and kFresh while its slot holds a
+  // message that has not been taken.
+  static const int kIndex = 3;
+  static const int kFresh = 4;
+
+  T slots_[3];
+  // Slot owned by the producer.
+  int back_;
+  std::atomic<int> middle_;
+  // Slot owned by the consumer.
+  int front_;
+};
+
+}  // namespace particle_filter
+
+#endif  // SRC_LATEST_MAILBOX_H_
@@ -0,0 +1,198 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    make_replay_log.cc
+\brief   Simulates a robot driving through a vector map, and writes the
+         laser scans, odometry and reference poses as a replay log.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "gflags/gflags.h"
+#include "shared/math/math_util.h"
+#include "shared/util/random.h"
+#include "vector_map/vector_map.h"
+#include "replay_log.h"
+
+using math_util::AngleDiff;
+using particle_filter::ReplayLog;
+using particle_filter::ReplayRecord;
+using std::string;
+using std::vector;
+using Eigen::Rotation2Df;
+using Eigen::Vector2f;
+
+DEFINE_string(map, "maps/GDC1.txt", "Map to drive through");
+DEFINE_string(out, "logs/GDC1_synthetic.log", "Replay log to write");
+DEFINE_string(path,
+              "14.7,8 14.7,31 14.7,8",
+              "Space separated x,y waypoints of the robot's path");
+DEFINE_double(speed, 1.0, "Driving speed, in m/s");
+DEFINE_double(turn_rate, 1.0, "Turning rate at waypoints, in rad/s");
+DEFINE_double(odom_rate, 40, "Odometry rate, in Hz");
+DEFINE_double(scan_rate, 10, "Laser scan rate, in Hz");
+DEFINE_int32(num_ranges, 541, "Rays per laser scan");
+DEFINE_double(range_noise, 0.02, "Laser range noise stddev, in meters");
+DEFINE_double(short_fraction,
+              0.02,
+              "Fraction of short returns from unmapped obstacles");
+DEFINE_double(odom_noise, 0.05, "Odometry noise, relative to the motion");
+DEFINE_int32(seed, 1, "Random seed");
+
+namespace {
+
+// Laser offset from the robot center, and scan geometry, as used by the
+// particle filter.
+const float kLaserOffset = 0.2;
+const float kRangeMin = 0.02;
+const float kRangeMax = 10.0;
+const float kAngleMin = -0.75 * M_PI;
+const float kAngleMax = 0.75 * M_PI;
+
+struct Pose {
+  Vector2f loc;
+  float angle;
+};
+
+// Time-stamped true poses along the path, sampled at the odometry rate: turn
+// in place towards every waypoint, then drive to it.
+vector<Pose> MakeTrajectory(const vector<Vector2f>& waypoints, double dt) {
+  vector<Pose> poses;
+  Pose p = {waypoints[0], 0};
+  if (waypoints.size() > 1) {
+    const Vector2f d = waypoints[1] - waypoints[0];
+    p.angle = atan2(d.y(), d.x());
+  }
+  poses.push_back(p);
+  for (size_t i = 1; i < waypoints.size(); ++i) {
+    const Vector2f d = waypoints[i] - p.loc;
+    const float heading = atan2(d.y(), d.x());
+    const float turn = AngleDiff(heading, p.angle);
+    const int turn_steps = ceil(fabs(turn) / (FLAGS_turn_rate * dt));
+    const float start_angle = p.angle;
+    for (int k = 1; k <= turn_steps; ++k) {
+      p.angle = start_angle + turn * k / turn_steps;
+      poses.push_back(p);
+    }
+    const Vector2f start_loc = p.loc;
+    const int drive_steps = ceil(d.norm() / (FLAGS_speed * dt));
+    for (int k = 1; k <= drive_steps; ++k) {
+      p.loc = start_loc + d * (static_cast<float>(k) / drive_steps);
+      poses.push_back(p);
+    }
+  }
+  return poses;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  vector<Vector2f> waypoints;
+  for (size_t i = 0; i < FLAGS_path.size();) {
+    float x = 0, y = 0;
+    int n = 0;
+    if (sscanf(FLAGS_path.c_str() + i, " %f,%f%n", &x, &y, &n) != 2) break;
+    waypoints.push_back(Vector2f(x, y));
+    i += n;
+  }
+  if (waypoints.empty()) {
+    fprintf(stderr, "ERROR: No waypoints in path '%s'\n", FLAGS_path.c_str());
+    return 1;
+  }
+
+  const vector_map::VectorMap map(FLAGS_map);
+  util_random::Random rng(FLAGS_seed);
+  const double dt = 1.0 / FLAGS_odom_rate;
+  const int scan_interval = std::max(1, static_cast<int>(
+      FLAGS_odom_rate / FLAGS_scan_rate + 0.5));
+  const vector<Pose> trajectory = MakeTrajectory(waypoints, dt);
+
+  ReplayLog log;
+  log.map = FLAGS_map;
+  log.init_loc = trajectory[0].loc;
+  log.init_angle = trajectory[0].angle;
+  // Odometry starts at the true pose, and then drifts: every increment of
+  // the motion, in the robot frame, is perturbed proportionally.
+  Pose odom = trajectory[0];
+  const float angle_increment =
+      (kAngleMax - kAngleMin) / static_cast<float>(FLAGS_num_ranges);
+  vector<float> ranges(FLAGS_num_ranges);
+  for (size_t i = 0; i < trajectory.size(); ++i) {
+    const double t = i * dt;
+    const Pose& pose = trajectory[i];
+    if (i > 0) {
+      const Pose& prev = trajectory[i - 1];
+      const Vector2f delta_loc =
+          Rotation2Df(-prev.angle) * (pose.loc - prev.loc);
+      const float delta_angle = AngleDiff(pose.angle, prev.angle);
+      const float sigma =
+          FLAGS_odom_noise * (delta_loc.norm() + fabs(delta_angle));
+      const Vector2f noisy_loc = delta_loc +
+          Vector2f(rng.Gaussian(0, sigma), rng.Gaussian(0, sigma));
+      odom.loc += Rotation2Df(odom.angle) * noisy_loc;
+      odom.angle += delta_angle + rng.Gaussian(0, sigma);
+    }
+    ReplayRecord r;
+    r.type = ReplayRecord::kOdometry;
+    r.time = t;
+    r.loc = odom.loc;
+    r.angle = odom.angle;
+    log.records.push_back(r);
+    if (i % scan_interval != 0) continue;
+
+    r.type = ReplayRecord::kReference;
+    r.loc = pose.loc;
+    r.angle = pose.angle;
+    log.records.push_back(r);
+
+    const Vector2f laser_loc =
+        pose.loc + kLaserOffset * Vector2f(cos(pose.angle), sin(pose.angle));
+    map.GetPredictedRanges(&laser_loc.x(),
+                           &laser_loc.y(),
+                           &pose.angle,
+                           1,
+                           kRangeMin,
+                           kRangeMax,
+                           kAngleMin,
+                           angle_increment,
+                           FLAGS_num_ranges,
+                           ranges.data());
+    for (float& range : ranges) {
+      if (rng.UniformRandom() < FLAGS_short_fraction) {
+        range = rng.UniformRandom(kRangeMin, range);
+      } else if (range < kRangeMax) {
+        range += rng.Gaussian(0, FLAGS_range_noise);
+      }
+    }
+    r.type = ReplayRecord::kScan;
+    r.range_min = kRangeMin;
+    r.range_max = kRangeMax;
+    r.angle_min = kAngleMin;
+    r.angle_max = kAngleMax;
+    r.ranges = ranges;
+    log.records.push_back(r);
+  }
+  if (!WriteReplayLog(FLAGS_out, log)) return 1;
+  printf("Wrote %lu records (%.1f s) to %s\n",
+         log.records.size(), trajectory.size() * dt, FLAGS_out.c_str());
+  return 0;
+}
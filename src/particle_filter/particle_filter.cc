@@ -19,9 +19,15 @@
 */
 //========================================================================
 
+#include <stdio.h>
+
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <random>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "eigen3/Eigen/Dense"
 #include "eigen3/Eigen/Geometry"
 #include "gflags/gflags.h"
@@ -30,24 +36,13 @@
 #include "shared/math/line2d.h"
 #include "shared/math/math_util.h"
 #include "shared/util/timer.h"
-#include "ros/ros.h"
-#include "rosbag/bag.h"
-#include "rosbag/view.h"
-#include "ros/package.h"
-
-
 #include "config_reader/config_reader.h"
+#include "metrics/metrics.h"
 #include "particle_filter.h"
-#include "amrl_msgs/VisualizationMsg.h"
-#include "amrl_msgs/Localization2DMsg.h"
-
-
-
+#include "vector_map/map_cache.h"
+#include "vector_map/map_registry.h"
 #include "vector_map/vector_map.h"
 
-#include "visualization/visualization.h"
-
-
 using geometry::line2f;
 using std::cout;
 using std::endl;
@@ -55,32 +50,193 @@ using std::string;
 using std::swap;
 using std::vector;
 using math_util::AngleDiff;
+using math_util::RadToDeg;
 using Eigen::Vector2f;
 using Eigen::Vector2i;
+using vector_map::CacheFileName;
 using vector_map::VectorMap;
-using visualization::DrawLine;
 
+DEFINE_double(num_particles, 100,
+              "Initial number of particles; KLD-sampling adapts it later");
 
+namespace particle_filter {
 
-// ros::Publisher visualization_publisher_;
-// ros::Publisher localization_publisher_;
-// ros::Publisher laser_publisher_;
-// VisualizationMsg vis_msg_;
+  // Observation model: "raycast" to ray cast every beam against the map
+  // lines, or "likelihood_field" to score beam endpoints against a
+  // precomputed distance field of the map.
+  CONFIG_STRING(obs_model_, "obs_model");
+  CONFIG_FLOAT(lf_resolution_, "lf_resolution");
+  CONFIG_FLOAT(lf_max_distance_, "lf_max_distance");
+  // Answer ray casts from a precomputed CDDT table once it has been built.
+  CONFIG_BOOL(use_cddt_, "use_cddt");
+  CONFIG_FLOAT(cddt_lane_width_, "cddt_lane_width");
+  CONFIG_INT(cddt_num_theta_, "cddt_num_theta");
+  // Threads for the predict and update steps; 0 uses the OpenMP default.
+  CONFIG_INT(num_threads_, "num_threads");
+  // Seed for all random number streams of the filter.
+  CONFIG_UINT(rng_seed_, "rng_seed");
+  // KLD-sampling: bounds on the number of particles, histogram bin sizes
+  // (meters and radians), error bound epsilon, and the upper standard normal
+  // quantile z of the confidence 1 - delta.
+  CONFIG_INT(kld_min_particles_, "kld_min_particles");
+  CONFIG_INT(kld_max_particles_, "kld_max_particles");
+  CONFIG_FLOAT(kld_bin_xy_, "kld_bin_xy");
+  CONFIG_FLOAT(kld_bin_theta_, "kld_bin_theta");
+  CONFIG_DOUBLE(kld_epsilon_, "kld_epsilon");
+  CONFIG_DOUBLE(kld_z_, "kld_z");
+  // Resample when the effective sample size falls below this fraction of the
+  // number of particles.
+  CONFIG_FLOAT(resample_ess_threshold_, "resample_ess_threshold");
+  // Resolution of the predicted scan cache, in meters and radians. Particles
+  // closer than this share one predicted scan; 0 disables the cache.
+  CONFIG_FLOAT(scan_cache_xy_, "scan_cache_xy");
+  CONFIG_FLOAT(scan_cache_theta_, "scan_cache_theta");
+  // Beams scored per scan: "uniform" for every ratio-th beam, or "adaptive"
+  // for beam_budget beams chosen by SelectBeams. Observed ranges further than
+  // beam_max_error (meters) from the expected range at the pose estimate are
+  // not chosen.
+  CONFIG_STRING(beam_selection_, "beam_selection");
+  CONFIG_INT(beam_budget_, "beam_budget");
+  CONFIG_FLOAT(beam_max_error_, "beam_max_error");
+  // Global localization: likelihood pyramid resolution (meters), likelihood
+  // width (meters) and number of levels; scan points matched, and their
+  // maximum range (meters); number of pose hypotheses to seed particles at,
+  // their minimum separation (meters and radians), and their lowest score
+  // relative to the best.
+  CONFIG_FLOAT(global_resolution_, "global_resolution");
+  CONFIG_FLOAT(global_sigma_, "global_sigma");
+  CONFIG_INT(global_levels_, "global_levels");
+  CONFIG_INT(global_num_points_, "global_num_points");
+  CONFIG_FLOAT(global_max_range_, "global_max_range");
+  CONFIG_INT(global_num_hypotheses_, "global_num_hypotheses");
+  CONFIG_FLOAT(global_separation_, "global_separation");
+  CONFIG_FLOAT(global_min_relative_score_, "global_min_relative_score");
+  // Directory to cache the map and the structures derived from it in, so
+  // that they are only built once per map and parameters. Empty to disable.
+  CONFIG_STRING(map_cache_dir_, "map_cache_dir");
+
+  // Always-on latency histograms and counters of the filter steps, exported
+  // by the node with metrics::MetricsFileWriter.
+  metrics::LatencyHistogram* const predict_latency_ =
+      metrics::GetHistogram("particle_filter.predict");
+  metrics::LatencyHistogram* const update_scan_latency_ =
+      metrics::GetHistogram("particle_filter.update_scan");
+  metrics::LatencyHistogram* const update_particle_latency_ =
+      metrics::GetHistogram("particle_filter.update_particle");
+  metrics::LatencyHistogram* const predict_ranges_latency_ =
+      metrics::GetHistogram("particle_filter.predict_ranges");
+  metrics::LatencyHistogram* const resample_latency_ =
+      metrics::GetHistogram("particle_filter.resample");
+  metrics::LatencyHistogram* const get_location_latency_ =
+      metrics::GetHistogram("particle_filter.get_location");
+  metrics::LatencyHistogram* const global_localization_latency_ =
+      metrics::GetHistogram("particle_filter.global_localization");
+  std::atomic<int64_t>* const scans_updated_ =
+      metrics::GetCounter("particle_filter.scans_updated");
+  std::atomic<int64_t>* const scans_skipped_ =
+      metrics::GetCounter("particle_filter.scans_skipped");
+  std::atomic<int64_t>* const num_particles_ =
+      metrics::GetCounter("particle_filter.num_particles");
+
+  // Index of the calling thread within the current parallel region.
+  int ThreadIndex() {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+  }
 
+  // Key of the (x, y, theta) histogram bin that contains the pose, for
+  // KLD-sampling and the predicted scan cache.
+  uint64_t PoseBin(const Vector2f& loc, float angle,
+                  float bin_xy, float bin_theta) {
+    const uint64_t x = static_cast<int32_t>(floor(loc.x() / bin_xy));
+    const uint64_t y = static_cast<int32_t>(floor(loc.y() / bin_xy));
+    const uint64_t t = static_cast<int32_t>(
+        floor(math_util::AngleMod(angle) / bin_theta));
+    return ((x & 0xFFFFFF) << 40) | ((y & 0xFFFFFF) << 16) | (t & 0xFFFF);
+  }
 
-DEFINE_double(num_particles, 100, "Number of particles");
+  // Load a map-derived structure from cache_file, or build it with build()
+  // and save it there. build returns false if it was aborted. An empty
+  // cache_file disables the cache.
+  template <typename T, typename BuildFn>
+  void LoadOrBuild(const string& cache_file,
+                   const string& map_file,
+                   BuildFn build,
+                   T* structure) {
+    if (structure->LoadCache(cache_file, map_file) || !build()) return;
+    if (!cache_file.empty() && !structure->SaveCache(cache_file)) {
+      printf("Unable to write map cache file %s\n", cache_file.c_str());
+    }
+  }
 
-namespace particle_filter {
+  // Number of threads in the current parallel region.
+  int NumThreads() {
+#ifdef _OPENMP
+    return omp_get_num_threads();
+#else
+    return 1;
+#endif
+  }
 
   config_reader::ConfigReader config_reader_({"config/particle_filter.lua"});
 
   ParticleFilter::ParticleFilter() :
+  map_(new VectorMap()),
+  global_pending_(false),
+  use_likelihood_field_(false),
+  cddt_cancel_(false),
+  num_threads_(1),
+  rngs_(1),
+  noise_(1),
+  scan_cache_hits_(0),
+  scan_cache_misses_(0),
   prev_odom_loc_(0, 0),
   prev_odom_angle_(0),
-  odom_initialized_(false) {}
+  odom_initialized_(false),
+  beam_model_(var_obs_, short_distance, long_distance, gamma) {
+    EstimatePose(particles_, &pose_estimate_);
+  }
+
+  ParticleFilter::~ParticleFilter() {
+    StopCDDTBuild();
+  }
+
+  void ParticleFilter::StopCDDTBuild() {
+    if (cddt_thread_.joinable()) {
+      cddt_cancel_ = true;
+      cddt_thread_.join();
+    }
+    cddt_cancel_ = false;
+  }
+
+  void ParticleFilter::BuildCDDT(const std::shared_ptr<const VectorMap> map,
+                                 const string map_file,
+                                 const string cache_file,
+                                 float lane_width,
+                                 int num_theta) {
+    std::shared_ptr<vector_map::CDDT> cddt(new vector_map::CDDT());
+    LoadOrBuild(cache_file, map_file, [&]() {
+      return cddt->Build(map->lines, map_file, lane_width, num_theta,
+                         &cddt_cancel_);
+    }, cddt.get());
+    if (!cddt->BuiltFor(map_file, lane_width, num_theta)) return;
+    printf("CDDT table for %s ready: %.1f MB\n",
+           map_file.c_str(),
+           cddt->MemoryUsage() / 1e6);
+    std::atomic_store(&cddt_, std::shared_ptr<const vector_map::CDDT>(cddt));
+  }
+
+  void ParticleFilter::GetScanCacheStats(uint64_t* hits,
+                                         uint64_t* misses) const {
+    *hits = scan_cache_hits_;
+    *misses = scan_cache_misses_;
+  }
 
   void ParticleFilter::GetParticles(vector<Particle>* particles) const {
-    *particles = particles_;
+    particles_.GetParticles(particles);
   }
 
 
@@ -109,57 +265,51 @@ namespace particle_filter {
 
   // .norm() of vector is magnitude
     // float magnitude = loc.norm();
-    Eigen::Vector2f lazer_offset(cos(angle),sin(angle));
+    const float c = cos(angle);
+    const float s = sin(angle);
+    Eigen::Vector2f lazer_offset(c, s);
     lazer_offset=lazer_offset*0.2;
     Eigen::Vector2f lazer_loc = loc+lazer_offset;
     float angle_range = angle_max-angle_min;
     float angle_increment= angle_range/float(num_ranges);
     float current_ray_angle = angle + angle_min;
+    // Ray i is beam i * ratio, rotated by the heading.
+    const std::shared_ptr<const scan_geometry::BeamDirections> directions =
+        scan_geometry::GetBeamDirections(angle_min, angle_max, num_ranges);
+
+    // Use the CDDT table once it is ready for the current map.
+    const std::shared_ptr<const vector_map::CDDT> cddt =
+        CONFIG_use_cddt_ ? std::atomic_load(&cddt_) : nullptr;
+    if (cddt) {
+      for (size_t i = 0; i < scan.size(); ++i) {
+        const Vector2f dir = directions->Rotated(i * ratio, c, s);
+        const float range = range_min + cddt->Range(
+            lazer_loc + range_min * dir, current_ray_angle,
+            range_max - range_min);
+        scan[i] = lazer_loc + range * dir;
+        current_ray_angle += angle_increment * ratio;
+      }
+      return;
+    }
 
     // TODO: Global frame vs Local frame
 
     for (size_t i = 0; i < scan.size(); ++i)
     {
 
-      Eigen::Vector2f ray_start(cos(current_ray_angle),sin(current_ray_angle));
-      Eigen::Vector2f ray_end(cos(current_ray_angle),sin(current_ray_angle));
+      const Eigen::Vector2f dir = directions->Rotated(i * ratio, c, s);
+      Eigen::Vector2f ray_start = dir;
+      Eigen::Vector2f ray_end = dir;
 
       //TODO: We need to add lidar location here
       ray_start= ray_start*range_min + lazer_loc;
       ray_end= ray_end*range_max + lazer_loc;
-      line2f current_ray(ray_start.x(), ray_start.y(), ray_end.x(), ray_end.y());
-
-      // visualization::DrawLine( ray_start, ray_end, 0xff0000, vis_msg_ );
-
-
-      // The line segments in the map are stored in the `map_.lines` variable. You
-      // can iterate through them as:
-
+      // Closest intersection with the map, found by walking the map's
+      // spatial index along the ray.
       Eigen::Vector2f closest_point = ray_end;
-      Eigen::Vector2f intersection_point(0,0);
-
-      for (size_t j = 0; j < map_.lines.size(); ++j)
-      {
-        const line2f map_line = map_.lines[j];
-        bool intersects = map_line.Intersection(current_ray, &intersection_point);
-        if (intersects)
-        {
-          // printf("Intersection\n" );
-          //TODO: Shouldn't we need to find distance with location and not lazer location.
-          float distance = (intersection_point - lazer_loc).norm();
-          // float distance = sqrt(pow(intersection_point.x()-lazer_loc.x(),2)+pow(intersection_point.y()-lazer_loc.y(),2));
-          // float closest_point_distance = sqrt(pow(intersection_point.x()-closest_point.x(),2)+pow(intersection_point.y()-closest_point.y(),2));
-          float closest_point_distance = (closest_point - lazer_loc).norm();
-          if(distance<closest_point_distance)
-          {
-            closest_point=intersection_point;
-          }
-        }
-
-      }
+      map_->GetClosestIntersection(ray_start, ray_end, &closest_point);
       scan[i]=closest_point;
    // scan[i] = Vector2f(0, 0);
-      current_ray_angle+=angle_increment*ratio;
     }
   }
 
@@ -180,7 +330,7 @@ namespace particle_filter {
     float range_max,
     float angle_min,
     float angle_max,
-    Particle* p_ptr) {
+    int particle_index) {
   // Implement the update step of the particle filter here.
   // You will have to use the `GetPredictedPointCloud` to predict the expected
   // observations for each particle, and assign weights to the particles based
@@ -197,54 +347,162 @@ namespace particle_filter {
     // vector<Vector2f>* scan_ptr)
 
 
-    Particle& particle = *p_ptr;
-    // std::cout<<particle.loc.x()<<" "<< particle.loc.y()<<std::endl;
-    std::vector<Eigen::Vector2f> predicted_pointCloud;
-    GetPredictedPointCloud(particle.loc,particle.angle,ranges.size(),range_min,range_max,angle_min,angle_max, &predicted_pointCloud);
-
-    unsigned int i = 0;
-    double distance = 0;
-
-    Eigen::Vector2f lazer_loc_local_frame(0.2, 0.0);
-
-    Eigen::Vector2f lazer_loc = convertToGlobalFrame( particle.loc , particle.angle, lazer_loc_local_frame );
-    double log_prob = 0;
-    double prob = 0;
+    const Vector2f particle_loc = particles_.Loc(particle_index);
+    const float particle_angle = particles_.angle[particle_index];
+    double& particle_log_weight = particles_.log_weight[particle_index];
+
+    if (use_likelihood_field_) {
+      // Likelihood field model: score each beam endpoint by its distance to
+      // the closest map line, looked up in the precomputed distance field.
+      const float c = cos(particle_angle);
+      const float s = sin(particle_angle);
+      const Vector2f lazer_loc = particle_loc + 0.2 * Vector2f(c, s);
+      double log_prob = 0;
+      for (size_t k = 0; k < beam_indices_.size(); ++k) {
+        const float range = ranges[beam_indices_[k]];
+        if (range < range_min || range > range_max) continue;
+        // Beam direction rotated by the particle heading.
+        const Vector2f dir(c * beam_cos_[k] - s * beam_sin_[k],
+                           s * beam_cos_[k] + c * beam_sin_[k]);
+        const Vector2f endpoint = lazer_loc + range * dir;
+        const float d = distance_field_.Distance(endpoint);
+        log_prob += - ( d * d ) / ( var_obs_ * var_obs_ );
+      }
+      particle_log_weight += gamma * log_prob;
+      return;
+    }
 
+    // Score the observed ranges of the scored beams, gathered once per scan,
+    // against this particle's expected ranges from PredictRanges.
+    const size_t num_beams = observed_ranges_.size();
+    particle_log_weight += ScoreBeams(beam_model_, observed_ranges_.data(),
+        predicted_ranges_.data() + scan_index_[particle_index] * num_beams,
+        num_beams, range_min, range_max);
+  }
 
-    for (i=0; i < predicted_pointCloud.size(); i++)
-    {
-      distance = sqrt( pow(predicted_pointCloud[i].x()-lazer_loc.x(),2) + pow(predicted_pointCloud[i].y()-lazer_loc.y(),2) );
-      if(ranges[ ratio * i] < range_min)
-      {
-        continue;
-      }
-      else if(ranges[ ratio * i] > range_max)
-      {
-        continue;
-      }
-      else if(ranges[ ratio * i] < distance - short_distance )
-      {
-        prob = exp( - ( short_distance*short_distance ) / ( var_obs_ * var_obs_ ) );
+  void ParticleFilter::SelectScanBeams(const vector<float>& ranges,
+    float range_min,
+    float range_max,
+    float angle_min,
+    float angle_max) {
+    const int num_ranges = ranges.size();
+    const float angle_increment =
+        (angle_max - angle_min) / static_cast<float>(num_ranges);
+    beam_indices_.clear();
+    if (CONFIG_beam_selection_ == "adaptive" && CONFIG_beam_budget_ > 0) {
+      // Predict the full scan from the pose estimate, to rate the beams.
+      const float x = pose_estimate_.loc.x() + 0.2 * cos(pose_estimate_.angle);
+      const float y = pose_estimate_.loc.y() + 0.2 * sin(pose_estimate_.angle);
+      expected_scan_.resize(num_ranges);
+      map_->GetPredictedRanges(&x, &y, &pose_estimate_.angle, 1,
+                               range_min, range_max,
+                               angle_min, angle_increment, num_ranges,
+                               expected_scan_.data());
+      SelectBeams(ranges.data(), expected_scan_.data(), num_ranges,
+                  range_min, range_max, angle_increment,
+                  CONFIG_beam_max_error_, CONFIG_beam_budget_,
+                  &beam_indices_);
+    } else {
+      for (int i = 0; i < num_ranges / ratio; ++i) {
+        beam_indices_.push_back(ratio * i);
       }
-      else if( ranges[  ratio * i ] > distance + long_distance )
-      {
-        prob = exp( - ( long_distance*long_distance ) / ( var_obs_ * var_obs_ ) );
+    }
+    const scan_geometry::BeamDirections& directions =
+        scan_geometry::UpdateBeamDirections(angle_min, angle_max, num_ranges,
+                                            &beam_directions_);
+    beam_angles_.resize(beam_indices_.size());
+    beam_cos_.resize(beam_indices_.size());
+    beam_sin_.resize(beam_indices_.size());
+    for (size_t i = 0; i < beam_indices_.size(); ++i) {
+      beam_angles_[i] = angle_min + beam_indices_[i] * angle_increment;
+      beam_cos_[i] = directions.cos_angle[beam_indices_[i]];
+      beam_sin_[i] = directions.sin_angle[beam_indices_[i]];
+    }
+  }
+
+  void ParticleFilter::PredictRanges(float range_min, float range_max) {
+    metrics::ScopedLatency latency(predict_ranges_latency_);
+    const size_t num_particles = particles_.size();
+    const int num_beams = beam_angles_.size();
+
+    // Particles whose poses fall in the same cache bin share the predicted
+    // scan of the first of them. After resampling, many particles are copies
+    // of each other, so this saves most of the ray casts once the filter
+    // has converged. The cache only lives for one scan.
+    const float cache_xy = CONFIG_scan_cache_xy_;
+    const float cache_theta = CONFIG_scan_cache_theta_;
+    const bool use_cache = cache_xy > 0 && cache_theta > 0;
+    scan_cache_.Clear();
+    scan_index_.resize(num_particles);
+    sensor_x_.clear();
+    sensor_y_.clear();
+    sensor_angle_.clear();
+    for (size_t i = 0; i < num_particles; ++i) {
+      const float angle = particles_.angle[i];
+      if (use_cache) {
+        const uint64_t key =
+            PoseBin(particles_.Loc(i), angle, cache_xy, cache_theta);
+        bool inserted = false;
+        scan_index_[i] = scan_cache_.Insert(key, sensor_x_.size(), &inserted);
+        if (!inserted) {
+          ++scan_cache_hits_;
+          continue;
+        }
+      } else {
+        scan_index_[i] = sensor_x_.size();
       }
-      else
-      {
-        prob = exp( - ( pow( distance - ranges[ ratio * i ] , 2) ) / (var_obs_ * var_obs_) );
+      ++scan_cache_misses_;
+      sensor_x_.push_back(particles_.x[i] + 0.2 * cos(angle));
+      sensor_y_.push_back(particles_.y[i] + 0.2 * sin(angle));
+      sensor_angle_.push_back(angle);
+    }
+    const size_t num_scans = sensor_x_.size();
+    predicted_ranges_.resize(num_scans * num_beams);
+
+    // Use the CDDT table once it is ready for the current map.
+    const std::shared_ptr<const vector_map::CDDT> cddt =
+        CONFIG_use_cddt_ ? std::atomic_load(&cddt_) : nullptr;
+    if (cddt) {
+      #pragma omp parallel for schedule(dynamic, 8) num_threads(num_threads_)
+      for (size_t i = 0; i < num_scans; ++i) {
+        const Vector2f lazer_loc(sensor_x_[i], sensor_y_[i]);
+        const float c = cos(sensor_angle_[i]);
+        const float s = sin(sensor_angle_[i]);
+        float* ranges = predicted_ranges_.data() + i * num_beams;
+        for (int j = 0; j < num_beams; ++j) {
+          const float a = sensor_angle_[i] + beam_angles_[j];
+          const Vector2f dir(c * beam_cos_[j] - s * beam_sin_[j],
+                             s * beam_cos_[j] + c * beam_sin_[j]);
+          ranges[j] = range_min + cddt->Range(
+              lazer_loc + range_min * dir, a, range_max - range_min);
+        }
       }
-      log_prob += log(prob);
+      return;
     }
 
-    particle.log_weight += gamma * log_prob;
-    // particle.weight += exp(log_prob);
+    // One batched ray cast per thread, over its slice of the poses.
+    #pragma omp parallel num_threads(num_threads_)
+    {
+      const int t = ThreadIndex();
+      const size_t begin = num_scans * t / NumThreads();
+      const size_t end = num_scans * (t + 1) / NumThreads();
+      map_->GetPredictedRanges(sensor_x_.data() + begin,
+                               sensor_y_.data() + begin,
+                               sensor_angle_.data() + begin,
+                               end - begin,
+                               range_min,
+                               range_max,
+                               beam_cos_.data(),
+                               beam_sin_.data(),
+                               num_beams,
+                               predicted_ranges_.data() + begin * num_beams);
+    }
   }
 
 
 void ParticleFilter::Resample()
 {
+    metrics::ScopedLatency latency(resample_latency_);
     // Resample the particles, proportional to their weights.
     // The current particles are in the `particles_` variable.
     // Create a variable to store the new particles, and when done, replace the
@@ -260,107 +518,77 @@ void ParticleFilter::Resample()
 
     //compute sum of all particle weights
 
-    std::cout << particles_.size() << "Particles size" << std::endl;
-
-    float totalWeightSum = 0;
-    double max_log_prob = -10000000.0;
-
-    for(unsigned int i=0; i<particles_.size(); i++)
-    {
-      max_log_prob = std::max(max_log_prob, particles_[i].log_weight);
-    }
-
-    // std::cout << "after finding max_log_prob" << particles_.size() << std::endl;
-
-    for(unsigned int i=0; i<particles_.size(); i++)
-    {
-      particles_[i].log_weight -= max_log_prob;
-      particles_[i].weight = exp(particles_[i].log_weight);
-      // std::cout << i << " " << particles_[i].weight << std::endl;
-      totalWeightSum += particles_[i].weight;
-    }
-
-    // std::cout << "after finding total prob" << particles_.size() << std::endl;
-
-
-    // for(auto& particle: particles_)
-    // {
-    //   totalWeightSum += particle.weight;
-    // }
-
-
-    // use vectors to encode the width of each bin.
-    // Width is equal to the weight of particle[i] proportional to the total sum of particle weights
-    unsigned int total_particles=FLAGS_num_particles;
-    float weightSum = 0;
-    std::vector<Vector2f> binSet;
-    for(unsigned int i=0; i< total_particles; ++i)
-    {
-        float start = weightSum / totalWeightSum;
-        weightSum += particles_[i].weight;
-        float end = weightSum / totalWeightSum;
-        // std::cout << i << " " << particles_[i].weight << " " << start << " " << end << std::endl;
-        Vector2f bin = Vector2f(start,end);
-        binSet.push_back(bin);
-    }
 
-    //new particle set
-    vector<Particle> newParticles_;
-    unsigned int j =0, i=0;
-    double avg_bin_size = 1.0 / total_particles;
-
-  //select a random value between 0 and 1 and  determine which bin it belongs to.
-  //Corresponding particle at bin will be resampled in the new particle set
-  // Run this step N (number of particles in set) times
-
-    float randNum = rng_.UniformRandom(0, 1);
-    std::cout << particles_.size() << std::endl;
-
-    while( j < total_particles )
+    const size_t num_particles = particles_.size();
+    if (num_particles == 0) return;
+    // Shift the log weights so that the largest is zero, and exponentiate.
+    const double totalWeightSum = NormalizeLogWeights(&particles_);
+
+    // KLD-sampling (Fox, 2003): choose the size of the new set so that, with
+    // probability 1 - delta, the KL divergence between the sample based
+    // posterior and the true posterior is below epsilon. The bound grows with
+    // the number k of (x, y, theta) histogram bins that the resampled
+    // particles occupy, so a spread-out posterior gets more particles than a
+    // converged one. k is counted over the particles that a systematic draw
+    // of the current size keeps.
+    const size_t min_particles = std::max(1, CONFIG_kld_min_particles_);
+    const size_t max_particles =
+        std::max<size_t>(min_particles, CONFIG_kld_max_particles_);
+    const float bin_xy = CONFIG_kld_bin_xy_;
+    const float bin_theta = CONFIG_kld_bin_theta_;
+    const double offset = rng_.UniformRandom(0, 1);
+    kld_bins_.Clear();
     {
-      while(binSet[i].x() < randNum && randNum <= binSet[i].y() )
+      double step = totalWeightSum / num_particles;
+      double target = offset * step;
+      double weightSum = 0;
+      for(size_t i = 0; i < num_particles; ++i)
       {
-        newParticles_.push_back(particles_[i]);
-        // std::cout << i << " " << particles_[i].loc << " " << particles_[i].weight << " " << particles_[i].log_weight << std::endl;
-        randNum += avg_bin_size;
-        j++;
-        if( j == total_particles )
-        {
-          break;
-        }
-        if (randNum > 1)
+        weightSum += particles_.weight[i];
+        if (weightSum > target)
         {
-          randNum -= 1;
+          bool inserted = false;
+          kld_bins_.Insert(PoseBin(particles_.Loc(i), particles_.angle[i],
+                                   bin_xy, bin_theta), 0, &inserted);
+          target += step * ceil((weightSum - target) / step);
         }
       }
-      i++;
-      if( i == total_particles )
+    }
+    size_t new_size = min_particles;
+    if (kld_bins_.size() > 1)
+    {
+      // Wilson-Hilferty approximation of the chi-square quantile.
+      const double k = kld_bins_.size() - 1;
+      const double a = 2.0 / (9.0 * k);
+      const double b = 1.0 - a + sqrt(a) * CONFIG_kld_z_;
+      new_size = std::max<size_t>(
+          min_particles, ceil(k / (2.0 * CONFIG_kld_epsilon_) * b * b * b));
+    }
+    new_size = std::min(new_size, max_particles);
+
+    // Systematic (low variance) resampling: a single pass over the particles
+    // with new_size evenly spaced pointers into the cumulative weights, all
+    // sharing one random offset. The new set is written into the back buffer,
+    // which keeps its storage between calls, and the buffers are swapped.
+    resampled_.resize(new_size);
+    const double log_weight = -log(new_size);
+    const double weight = exp(log_weight);
+    const double step = totalWeightSum / new_size;
+    double weightSum = particles_.weight[0];
+    size_t i = 0;
+    for(size_t j = 0; j < new_size; ++j)
+    {
+      const double target = (offset + j) * step;
+      while (weightSum < target && i + 1 < num_particles)
       {
-        i = 0;
+        ++i;
+        weightSum += particles_.weight[i];
       }
-      // std::cout << i << " " << j << " " << randNum << " " << binSet[i].x() << " " << binSet[i].y() << std::endl;
+      resampled_.CopyFrom(particles_, i, j);
+      resampled_.weight[j] = weight;
+      resampled_.log_weight[j] = log_weight;
     }
-
-
-   /* float r = rng_.UniformRandom(0, 1/total_particles);
-    double c = particles_[0];
-    x = 1;
-    for(unsigned int m = 0; m < total_particles ; m++){
-        double U = r + (m -1) * (1/total_particles);
-        while( U > c)
-        {
-          x += 1;
-          c += particles_[x];
-        }
-        newParticles_.push_back(particles_[x]);
-    } */
-
-
-
-   //   printf("Random number drawn from uniform distribution between 0 and 1: %f\n",
-    //   x);
-
-    particles_ = newParticles_;
+    std::swap(particles_, resampled_);
 }
 
 
@@ -373,6 +601,18 @@ void ParticleFilter::ObserveLaser(const vector<float>& ranges,
   // A new laser scan observation is available (in the laser frame)
   // Call the Update and Resample steps as necessary.
 
+  // After a global search, the seeded particles are scored against the same
+  // scan, whether or not the robot has moved. A failed search is retried with
+  // the next scan.
+  const bool seeded = global_pending_;
+  if (global_pending_) {
+    if (!LocalizeGlobally(ranges, range_min, range_max, angle_min,
+                          angle_max)) {
+      return;
+    }
+    global_pending_ = false;
+  }
+
   if(odom_initialized_ == false)
   {
     return;
@@ -382,66 +622,63 @@ void ParticleFilter::ObserveLaser(const vector<float>& ranges,
 
   double distance_from_last_update = (prev_odom_loc_ - last_update).norm();
 
-  if (distance_from_last_update < 0.1)
+  if (!seeded && distance_from_last_update < 0.1)
   {
+    ++*scans_skipped_;
     return;
   }
-
-    unsigned int i = 0;
-    std::cout << odom_initialized_ << " before update " << std::endl;
-    for(i=0; i < particles_.size(); i++)
+    metrics::ScopedLatency latency(update_scan_latency_);
+    ++*scans_updated_;
+
+    const int num_particles = particles_.size();
+    // Choose the observation model once per scan: the config may be reloaded
+    // while the particles are being updated.
+    use_likelihood_field_ =
+        CONFIG_obs_model_ == "likelihood_field" && !distance_field_.Empty();
+    SelectScanBeams(ranges, range_min, range_max, angle_min, angle_max);
+    if (!use_likelihood_field_) {
+      // Gather the observed ranges of the scored beams, and ray cast the
+      // expected ranges of all particles at once.
+      observed_ranges_.resize(beam_indices_.size());
+      for (size_t i = 0; i < observed_ranges_.size(); ++i) {
+        observed_ranges_[i] = ranges[beam_indices_[i]];
+      }
+      PredictRanges(range_min, range_max);
+    }
+    // Particles are scored independently, so spread them over the threads.
+    // Each thread times its particles into its own buffer, added to the
+    // histogram once per scan.
+    #pragma omp parallel num_threads(num_threads_)
     {
-      Update( ranges, range_min, range_max, angle_min, angle_max, &particles_[i] );
+      metrics::LatencyBuffer latencies(update_particle_latency_);
+      #pragma omp for schedule(dynamic, 8)
+      for(int i=0; i < num_particles; i++)
+      {
+        const double t_start = GetMonotonicTime();
+        Update( ranges, range_min, range_max, angle_min, angle_max, i );
+        latencies.Record(GetMonotonicTime() - t_start);
+      }
     }
     updateCount++;
-std::cout << odom_initialized_ << " after update " << updateCount << std::endl;
 
-    //resample less often: control how many times resample is called based on number of updates ; default is 1 (resample all the time)
-    if(updateCount % modOperator == 0){
-      std::cout << odom_initialized_ << " Going in Resample " << std::endl;
+    // Resample only once the weights have degenerated, i.e. when the
+    // effective sample size drops below a fraction of the particle count.
+    // Resampling more often only loses particle diversity.
+    NormalizeLogWeights(&particles_);
+    if(EffectiveSampleSize(particles_) <
+       CONFIG_resample_ess_threshold_ * particles_.size()){
       Resample();
     }
+    EstimatePose(particles_, &pose_estimate_);
+    *num_particles_ = particles_.size();
     last_update = prev_odom_loc_;
-    std::cout << odom_initialized_ << " after Resample " << std::endl;
 
   }
 
 
-  void ParticleFilter::TransformParticle(Particle* particle_pointer,const Eigen::Vector2f& transform, const float& rotation,const float& k1,const float& k2,const float& k3,const float& k4){
-  //k1 : translation error from translation
-  //k2 : rotation error from translation
-  //k3 : rotation error from rotation
-  //k4 : translation error from rotation
-
-  //k1 and k2 should be larger than k3 and k4 to create a oval that is longer along the x axis
-
-  Particle& particle = *particle_pointer;
-
-  // std::cout << "Transform:" << transform << " rotation:" << rotation << std::endl;
-
-    float magnitude_of_transform = sqrt((transform.x()*transform.x())+(transform.y()*transform.y()) );
-    float magnitude_of_rotation = abs(rotation);
-    //adding some constant to k1 and k2 to make the the probability density contour more oval like
-    float x_translation_error_stdev= (k1)*magnitude_of_transform+ (k2)*magnitude_of_rotation;
-    float y_translation_error_stdev= k1*magnitude_of_transform+ k2*magnitude_of_rotation;
-    float rotation_error_stdev= k3*magnitude_of_transform+ k4*magnitude_of_rotation;
-
-    // std::cout<<magnitude_of_transform<<magnitude_of_rotation<<x_translation_error_stdev<<y_translation_error_stdev<<rotation_error_stdev<<std::endl;
-    float epsilon_x= rng_.Gaussian(0.0, x_translation_error_stdev);
-    float epsilon_y= rng_.Gaussian(0.0, y_translation_error_stdev);
-    float epsilon_theta=rng_.Gaussian(0.0, rotation_error_stdev);
-
-    particle.loc.x() += transform.x()+ epsilon_x;
-    particle.loc.y() += transform.y()+ epsilon_y;
-    // not sure if this is correct either
-    particle.angle+= rotation+epsilon_theta;
-
-    // std::cout << particle.loc.x() << " in TransformParticle " << particle.loc.y() << std::endl;
-
-  }
-
   void ParticleFilter::Predict(const Vector2f& odom_loc,
    const float odom_angle) {
+  metrics::ScopedLatency latency(predict_latency_);
   // Implement the predict step of the particle filter here.
   // A new odometry value is available (in the odom frame)
   // Implement the motion model predict step here, to propagate the particles
@@ -457,15 +694,48 @@ std::cout << odom_initialized_ << " after update " << updateCount << std::endl;
       else
       {
         float deltaTransformAngle = AngleDiff(odom_angle, prev_odom_angle_);
-         for(auto& particle: particles_)
-         {
-
-            Eigen::Rotation2Df rotation( -prev_odom_angle_ );
-            Eigen::Vector2f deltaTransformBaseLink =  rotation * (odom_loc-prev_odom_loc_) ;
-	    particle.loc= particle.loc +Eigen::Rotation2Df(particle.angle)*deltaTransformBaseLink;
-	    particle.angle= particle.angle+ deltaTransformAngle;
-            TransformParticle(&particle, deltaTransformBaseLink, deltaTransformAngle, 0.1, 0.1, 0.1, 0.1 );
+        Eigen::Rotation2Df rotation( -prev_odom_angle_ );
+        const Eigen::Vector2f deltaTransformBaseLink =  rotation * (odom_loc-prev_odom_loc_) ;
+
+        //k1 : translation error from translation
+        //k2 : translation error from rotation
+        //k3 : rotation error from translation
+        //k4 : rotation error from rotation
+        const float k1 = 0.1, k2 = 0.1, k3 = 0.1, k4 = 0.1;
+        const float magnitude_of_transform = deltaTransformBaseLink.norm();
+        const float magnitude_of_rotation = fabs(deltaTransformAngle);
+        const float translation_error_stdev =
+            k1 * magnitude_of_transform + k2 * magnitude_of_rotation;
+        const float rotation_error_stdev =
+            k3 * magnitude_of_transform + k4 * magnitude_of_rotation;
+
+        // Every thread moves a fixed slice of the particles, drawing the
+        // noise for its slice from its own stream, then runs the vectorized
+        // motion and noise kernels over the slice.
+        const size_t num_particles = particles_.size();
+        #pragma omp parallel num_threads(num_threads_)
+        {
+          const int t = ThreadIndex();
+          const size_t begin = num_particles * t / NumThreads();
+          const size_t end = num_particles * (t + 1) / NumThreads();
+          const size_t n = end - begin;
+          AlignedVector<float>& noise = noise_[t];
+          noise.resize(3 * n);
+          for (float& v : noise) {
+            v = rngs_[t].Gaussian(0.0, 1.0);
           }
+          ApplyOdometry(deltaTransformBaseLink, deltaTransformAngle,
+                        begin, end, &particles_);
+          AddGaussianNoise(noise.data(), translation_error_stdev,
+                           begin, end, particles_.x.data());
+          AddGaussianNoise(noise.data() + n, translation_error_stdev,
+                           begin, end, particles_.y.data());
+          AddGaussianNoise(noise.data() + 2 * n, rotation_error_stdev,
+                           begin, end, particles_.angle.data());
+        }
+        ApplyOdometry(deltaTransformBaseLink, deltaTransformAngle,
+                      translation_error_stdev, rotation_error_stdev,
+                      &pose_estimate_);
           prev_odom_loc_ = odom_loc;
           prev_odom_angle_ = odom_angle;
       }
@@ -494,9 +764,9 @@ void ParticleFilter::Initialize(const string& map_file,
   // some distribution around the provided location and angle.
 
   unsigned int total_particles=FLAGS_num_particles;
-  odom_initialized_ = false;
-
   std::cout << "In initialization" << std::endl;
+  Reset(map_file);
+  global_pending_ = false;
 
   for(unsigned int i=0; i< total_particles; ++i){
 
@@ -506,49 +776,181 @@ void ParticleFilter::Initialize(const string& map_file,
     particle.loc.y() = loc.y()+ rng_.Gaussian(0.0, 0.1);
       //angle within theta of 30
     particle.angle = angle+rng_.Gaussian(0.0, M_PI/6);
-    particle.weight = (1.0)/FLAGS_num_particles;
+    particle.weight = (1.0)/total_particles;
     particle.log_weight = log( particle.weight );
     particles_.push_back(particle);
   }
-  map_.Load(map_file);
+  EstimatePose(particles_, &pose_estimate_);
 }
 
-void ParticleFilter::GetLocation(Eigen::Vector2f* loc_ptr,
- float* angle_ptr) const {
-  Vector2f& loc = *loc_ptr;
-  float& angle = *angle_ptr;
-  // Compute the best estimate of the robot's location based on the current set
-  // of particles. The computed values must be set to the `loc` and `angle`
-  // variables to return them. Modify the following assignments:
-
-  double max_log_prob = 0.0, totalWeightSum = 0.0, p_weights[int(FLAGS_num_particles)];
-
-  for(unsigned int i=0; i<particles_.size(); i++)
-  {
-    max_log_prob = std::max(max_log_prob, particles_[i].log_weight);
+void ParticleFilter::InitializeGlobal(const string& map_file) {
+  Reset(map_file);
+  if (!global_localizer_.BuiltFor(map_file, CONFIG_global_resolution_,
+                                  CONFIG_global_sigma_, CONFIG_global_levels_,
+                                  CONFIG_global_max_range_)) {
+    const string params = std::to_string(CONFIG_global_resolution_) + ":" +
+        std::to_string(CONFIG_global_sigma_) + ":" +
+        std::to_string(CONFIG_global_levels_) + ":" +
+        std::to_string(CONFIG_global_max_range_);
+    LoadOrBuild(CacheFileName(CONFIG_map_cache_dir_, "global_localizer",
+                              map_file, params),
+                map_file,
+                [&]() {
+                  global_localizer_.Build(*map_, CONFIG_global_resolution_,
+                                          CONFIG_global_sigma_,
+                                          CONFIG_global_levels_,
+                                          CONFIG_global_max_range_);
+                  return true;
+                },
+                &global_localizer_);
   }
+  // The particles are seeded by the next laser scan.
+  global_pending_ = true;
+  EstimatePose(particles_, &pose_estimate_);
+}
 
-  for(unsigned int i=0; i<particles_.size(); i++)
-  {
-    p_weights[i] = exp(particles_[i].log_weight - max_log_prob);
-    // p_weights[i] = particles_[i].weight;
-    totalWeightSum += p_weights[i];
+bool ParticleFilter::LocalizeGlobally(const vector<float>& ranges,
+                                      float range_min,
+                                      float range_max,
+                                      float angle_min,
+                                      float angle_max) {
+  metrics::ScopedLatency latency(global_localization_latency_);
+  // Scan endpoints in the laser frame, thinned to global_num_points. Far
+  // points need a finer angular search, so they are capped at
+  // global_max_range.
+  const float max_range = std::min(range_max, CONFIG_global_max_range_);
+  const scan_geometry::BeamDirections& directions =
+      scan_geometry::UpdateBeamDirections(angle_min, angle_max, ranges.size(),
+                                          &beam_directions_);
+  vector<Vector2f> valid_points;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    if (ranges[i] <= range_min || ranges[i] >= max_range) continue;
+    valid_points.push_back(ranges[i] * directions.Direction(i));
+  }
+  const size_t num_points =
+      std::min<size_t>(valid_points.size(), CONFIG_global_num_points_);
+  vector<Vector2f> points(num_points);
+  for (size_t i = 0; i < num_points; ++i) {
+    points[i] = valid_points[i * valid_points.size() / num_points];
   }
 
-  Eigen::Vector2f next_robot_loc(0.0, 0.0);
-  double next_robot_angle = 0.0;
+  vector<PoseHypothesis> hypotheses;
+  global_localizer_.Search(points, CONFIG_global_num_hypotheses_,
+                           CONFIG_global_separation_,
+                           CONFIG_global_min_relative_score_, num_threads_,
+                           &hypotheses);
+  if (hypotheses.empty()) {
+    printf("Global localization: no pose found for %lu scan points, "
+           "retrying with the next scan\n", num_points);
+    return false;
+  }
 
-  for(unsigned int i=0; i<particles_.size(); i++)
-  {
-    next_robot_loc += ( p_weights[i] / totalWeightSum )*particles_[i].loc;
-    next_robot_angle += ( p_weights[i] / totalWeightSum )*particles_[i].angle;
+  // Spread the particles evenly over the hypotheses, within one search step
+  // of each. The hypotheses are laser poses, 0.2 m ahead of the robot.
+  const float sigma_xy = CONFIG_global_resolution_;
+  const float sigma_angle = global_localizer_.AngleStep(points);
+  const size_t total_particles = FLAGS_num_particles;
+  particles_.clear();
+  for (size_t i = 0; i < total_particles; ++i) {
+    const PoseHypothesis& h = hypotheses[i % hypotheses.size()];
+    Particle particle;
+    particle.angle = h.angle + rng_.Gaussian(0.0, sigma_angle);
+    particle.loc = h.loc - 0.2 * Vector2f(cos(h.angle), sin(h.angle)) +
+        Vector2f(rng_.Gaussian(0.0, sigma_xy), rng_.Gaussian(0.0, sigma_xy));
+    particle.weight = 1.0 / total_particles;
+    particle.log_weight = log(particle.weight);
+    particles_.push_back(particle);
   }
-  loc = next_robot_loc;
-  angle = next_robot_angle;
+  EstimatePose(particles_, &pose_estimate_);
+  printf("Global localization: %lu hypotheses, best (%f,%f) %f\u00b0 "
+         "score %f\n",
+         hypotheses.size(),
+         hypotheses[0].loc.x(),
+         hypotheses[0].loc.y(),
+         RadToDeg(hypotheses[0].angle),
+         hypotheses[0].score);
+  return true;
+}
 
-  // std::cout << loc << " location and angle in get location " << angle << " " << particles_.size() << std::endl;
+void ParticleFilter::Reset(const string& map_file) {
+  odom_initialized_ = false;
+  particles_.clear();
+  // Reserve the largest set KLD-sampling may produce, for both buffers, so
+  // that resampling does not allocate.
+  particles_.reserve(std::max<int>(FLAGS_num_particles,
+                                   CONFIG_kld_max_particles_));
+  resampled_.reserve(std::max<int>(FLAGS_num_particles,
+                                   CONFIG_kld_max_particles_));
+
+  // Re-seed all random number streams, one per thread.
+#ifdef _OPENMP
+  num_threads_ = (CONFIG_num_threads_ > 0) ?
+      CONFIG_num_threads_ : omp_get_max_threads();
+#else
+  num_threads_ = 1;
+#endif
+  rng_ = util_random::Random(CONFIG_rng_seed_);
+  rngs_.clear();
+  for (int t = 0; t < num_threads_; ++t) {
+    std::seed_seq seq = {CONFIG_rng_seed_, static_cast<unsigned int>(t) + 1};
+    unsigned int seed = 0;
+    seq.generate(&seed, &seed + 1);
+    rngs_.push_back(util_random::Random(seed));
+  }
+  noise_.resize(num_threads_);
+  // Maps are shared with everything else in the process, and only parsed
+  // the first time they are used.
+  vector_map::SetMapCacheDirectory(CONFIG_map_cache_dir_);
+  map_ = vector_map::GetMap(map_file);
+  if (!map_) {
+    fprintf(stderr, "ERROR: Unable to load map %s\n", map_file.c_str());
+    map_.reset(new VectorMap());
+  }
+  if (CONFIG_obs_model_ == "likelihood_field" &&
+      !distance_field_.BuiltFor(map_file, CONFIG_lf_resolution_,
+                                CONFIG_lf_max_distance_)) {
+    LoadOrBuild(CacheFileName(CONFIG_map_cache_dir_, "distance_field", map_file,
+                              std::to_string(CONFIG_lf_resolution_) + ":" +
+                              std::to_string(CONFIG_lf_max_distance_)),
+                map_file,
+                [&]() {
+                  distance_field_.Build(*map_, CONFIG_lf_resolution_,
+                                        CONFIG_lf_max_distance_);
+                  return true;
+                },
+                &distance_field_);
+  }
+  if (CONFIG_use_cddt_) {
+    const string params = std::to_string(CONFIG_cddt_lane_width_) + ":" +
+        std::to_string(CONFIG_cddt_num_theta_);
+    const string key = map_file + ":" + params;
+    if (key != cddt_build_key_) {
+      // Discard the table of the previous map, and build the new one in the
+      // background. Exact ray casts are used until it is ready.
+      StopCDDTBuild();
+      std::atomic_store(&cddt_, std::shared_ptr<const vector_map::CDDT>());
+      cddt_build_key_ = key;
+      cddt_thread_ = std::thread(&ParticleFilter::BuildCDDT,
+                                 this,
+                                 map_,
+                                 map_file,
+                                 CacheFileName(CONFIG_map_cache_dir_, "cddt",
+                                               map_file, params),
+                                 CONFIG_cddt_lane_width_,
+                                 CONFIG_cddt_num_theta_);
+    }
+  }
+}
 
+void ParticleFilter::GetLocation(Eigen::Vector2f* loc_ptr,
+ float* angle_ptr) const {
+  metrics::ScopedLatency latency(get_location_latency_);
+  *loc_ptr = pose_estimate_.loc;
+  *angle_ptr = pose_estimate_.angle;
 }
 
+void ParticleFilter::GetLocationCovariance(Eigen::Matrix3f* covariance) const {
+  *covariance = pose_estimate_.covariance;
+}
 
 }  // namespace particle_filter
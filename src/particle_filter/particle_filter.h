@@ -19,7 +19,13 @@
 */
 //========================================================================
 
+#include <stdint.h>
+
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 #include <math.h>
 
@@ -27,6 +33,14 @@
 #include "eigen3/Eigen/Geometry"
 #include "shared/math/line2d.h"
 #include "shared/util/random.h"
+#include "particle_filter/beam_model.h"
+#include "particle_filter/beam_selection.h"
+#include "particle_filter/global_localizer.h"
+#include "particle_filter/particle_set.h"
+#include "particle_filter/pose_bin_map.h"
+#include "scan_geometry/beam_directions.h"
+#include "vector_map/cddt.h"
+#include "vector_map/distance_field.h"
 #include "vector_map/vector_map.h"
 
 #ifndef SRC_PARTICLE_FILTER_H_
@@ -34,18 +48,14 @@
 
 namespace particle_filter {
 
-struct Particle {
-  Eigen::Vector2f loc;
-  float angle;
-  double weight;
-  double log_weight;
-};
-
 class ParticleFilter {
  public:
   // Default Constructor.
    ParticleFilter();
 
+  // Destructor: stops any background table builds.
+  ~ParticleFilter();
+
   // Observe a new laser scan.
   void ObserveLaser(const std::vector<float>& ranges,
                     float range_min,
@@ -62,24 +72,41 @@ class ParticleFilter {
                   const Eigen::Vector2f& loc,
                   const float angle);
 
-  // Return the list of particles.
+  // Initialize the robot location by a search of the whole map, for when the
+  // robot's location is unknown. The particles are seeded at the poses that
+  // best explain the next laser scan.
+  void InitializeGlobal(const std::string& map_file);
+
+  // Number of predicted scans shared from the scan cache (hits) and ray cast
+  // (misses), since construction.
+  void GetScanCacheStats(uint64_t* hits, uint64_t* misses) const;
+
+  // Return a copy of the list of particles.
   void GetParticles(std::vector<Particle>* particles) const;
 
-  // Get robot's current location.
+  // The particles, in place. Valid until the next call that changes the
+  // filter.
+  const ParticleSet& Particles() const { return particles_; }
+
+  // Get robot's current location: the weighted mean pose of the particles,
+  // cached between updates.
   void GetLocation(Eigen::Vector2f* loc, float* angle) const;
 
-  // Update particle weight based on laser.
+  // Covariance of the particle poses about the location, in (x, y, angle).
+  void GetLocationCovariance(Eigen::Matrix3f* covariance) const;
+
+  // Update the weight of particle particle_index based on laser. Expects the
+  // scored beams chosen by ObserveLaser, and unless the likelihood field
+  // model is used, the observed and expected ranges it prepared.
   void Update(const std::vector<float>& ranges,
               float range_min,
               float range_max,
               float angle_min,
               float angle_max,
-              Particle* p);
+              int particle_index);
 
   // Resample particles.
   void Resample();
-  //helper function for transforming a individual particle
-  void TransformParticle(Particle* particle_pointer,const Eigen::Vector2f& transform, const float& rotation,const float& k1,const float& k2,const float& k3,const float& k4);
   // For debugging: get predicted point cloud from current location.
   void GetPredictedPointCloud(const Eigen::Vector2f& loc,
                               const float angle,
@@ -95,20 +122,126 @@ class ParticleFilter {
 
 
  private:
+  // Load the CDDT ray cast table for the given map lines from cache_file, or
+  // build it and save it there, and publish it to cddt_ once complete. Runs
+  // on cddt_thread_.
+  void BuildCDDT(const std::shared_ptr<const vector_map::VectorMap> map,
+                 const std::string map_file,
+                 const std::string cache_file,
+                 float lane_width,
+                 int num_theta);
+
+  // Reset the particles and random number streams, and load the map and its
+  // derived tables.
+  void Reset(const std::string& map_file);
+
+  // Seed the particles at the best poses for the scan found by
+  // global_localizer_. Returns false, leaving the particles unchanged, if the
+  // search found no pose.
+  bool LocalizeGlobally(const std::vector<float>& ranges,
+                        float range_min,
+                        float range_max,
+                        float angle_min,
+                        float angle_max);
+
+  // Cancel and wait for any in-progress CDDT build.
+  void StopCDDTBuild();
+
+  // Choose the beams of the scan to score, into beam_indices_, beam_angles_
+  // and their directions beam_cos_ and beam_sin_: every ratio-th beam, or a
+  // budget of informative beams chosen by SelectBeams, depending on the
+  // beam_selection config.
+  void SelectScanBeams(const std::vector<float>& ranges,
+                       float range_min,
+                       float range_max,
+                       float angle_min,
+                       float angle_max);
 
-  // List of particles being tracked.
-  std::vector<Particle> particles_;
+  // Compute the expected ranges of the chosen beams for all particles into
+  // predicted_ranges_, with one batched map query per thread, or from the
+  // CDDT table once it is ready.
+  void PredictRanges(float range_min, float range_max);
 
+  // Particles being tracked.
+  ParticleSet particles_;
+  // Back buffer that Resample writes the new particles into before swapping
+  // it with particles_.
+  ParticleSet resampled_;
 
 
-  // Map of the environment.
-  vector_map::VectorMap map_;
 
-  // Random number generator.
+  // Map of the environment, shared read-only through the map registry.
+  std::shared_ptr<const vector_map::VectorMap> map_;
+
+  // Distance field of the map, used by the likelihood field observation model.
+  vector_map::DistanceField distance_field_;
+
+  // Likelihood pyramid of the map, for global localization.
+  GlobalLocalizer global_localizer_;
+  // Set by InitializeGlobal until a laser scan seeds the particles.
+  bool global_pending_;
+
+  // Whether the current scan is scored with the likelihood field model.
+  bool use_likelihood_field_;
+
+  // CDDT ray cast table for the current map. Null until the background
+  // build completes; exact ray casts are used until then.
+  std::shared_ptr<const vector_map::CDDT> cddt_;
+  // Background thread building the CDDT table.
+  std::thread cddt_thread_;
+  // Set to abort the background build.
+  std::atomic<bool> cddt_cancel_;
+  // Map and parameters of the most recently requested CDDT build.
+  std::string cddt_build_key_;
+
+  // Random number generator, for serial draws.
   util_random::Random rng_;
 
-  // modulo operator to control how often resample is called
-  unsigned int modOperator = 2;
+  // Number of threads used for the predict and update steps.
+  int num_threads_;
+
+  // One random number stream per thread, for the parallel predict step.
+  // Thread i always handles the same slice of particles and draws only from
+  // rngs_[i], so results are reproducible for a given seed and thread count.
+  std::vector<util_random::Random> rngs_;
+
+  // Weighted mean pose of the particles. Recomputed from the particles after
+  // every laser update and on initialization, and moved with odometry in
+  // between.
+  PoseEstimate pose_estimate_;
+
+  // Histogram bins occupied by the resampled particles, for KLD-sampling.
+  PoseBinMap kld_bins_;
+
+  // Per-thread scratch buffers for the motion noise samples.
+  std::vector<AlignedVector<float> > noise_;
+
+  // Beam directions of the current scan geometry.
+  std::shared_ptr<const scan_geometry::BeamDirections> beam_directions_;
+  // Indices of the scored beams of the current scan, and their angles and
+  // unit directions relative to the laser heading.
+  std::vector<int> beam_indices_;
+  AlignedVector<float> beam_angles_;
+  AlignedVector<float> beam_cos_;
+  AlignedVector<float> beam_sin_;
+  // Full scan predicted from the pose estimate, for adaptive beam selection.
+  std::vector<float> expected_scan_;
+  // Observed ranges of the scored beams of the current scan.
+  AlignedVector<float> observed_ranges_;
+  // Expected ranges of the scored beams, one row per particle.
+  AlignedVector<float> predicted_ranges_;
+  // Laser poses to predict scans for: one per bin of the scan cache.
+  AlignedVector<float> sensor_x_;
+  AlignedVector<float> sensor_y_;
+  AlignedVector<float> sensor_angle_;
+  // Row of predicted_ranges_ for every particle.
+  std::vector<uint32_t> scan_index_;
+  // Row of predicted_ranges_ for every occupied bin of the scan cache.
+  PoseBinMap scan_cache_;
+  // Number of particles that shared or needed a predicted scan, since
+  // construction.
+  uint64_t scan_cache_hits_;
+  uint64_t scan_cache_misses_;
 
   unsigned long long int updateCount;
 
@@ -123,6 +256,9 @@ class ParticleFilter {
   float gamma = 1.0;
   int ratio = 10;
   Eigen::Vector2f last_update;
+
+  // Beam model parameters, precomputed from the values above.
+  BeamModel beam_model_;
 };
 }  // namespace slam
 
@@ -27,6 +27,12 @@
 #include <string.h>
 #include <inttypes.h>
 #include <termios.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "eigen3/Eigen/Dense"
@@ -47,12 +53,17 @@
 #include "shared/math/line2d.h"
 #include "shared/util/timer.h"
 
+#include "metrics/metrics.h"
+#include "vector_map/map_registry.h"
+#include "latest_mailbox.h"
 #include "particle_filter.h"
 #include "visualization/visualization.h"
 
 using amrl_msgs::VisualizationMsg;
 using geometry::line2f;
 using geometry::Line;
+using math_util::AngleDiff;
+using math_util::AngleMod;
 using math_util::DegToRad;
 using math_util::RadToDeg;
 using ros::Time;
@@ -71,26 +82,90 @@ DEFINE_string(odom_topic, "/odom", "Name of ROS topic for odometry data");
 DEFINE_string(init_topic,
               "/set_pose",
               "Name of ROS topic for initialization");
+DEFINE_string(global_init_topic,
+              "/global_localization",
+              "Name of ROS topic to request global localization in the map "
+              "of the message, ignoring its pose");
+DEFINE_string(map_dir, "maps", "Directory of the map files");
+DEFINE_bool(preload_maps,
+            false,
+            "Load every map in map_dir at startup, rather than on first use");
+DEFINE_string(metrics_file,
+              "",
+              "File to periodically write latency and queue metrics to, as "
+              "JSON. Empty to disable.");
+DEFINE_double(metrics_period, 1.0, "Period of metrics file updates, in s");
 
 DECLARE_int32(v);
 
 // Create config reader entries
 CONFIG_STRING(map_name_, "map");
+CONFIG_STRING(map_cache_dir_, "map_cache_dir");
 CONFIG_FLOAT(init_x_, "init_x");
 CONFIG_FLOAT(init_y_, "init_y");
 CONFIG_FLOAT(init_r_, "init_r");
 config_reader::ConfigReader config_reader_({"config/particle_filter.lua"});
 
-bool run_ = true;
+std::atomic<bool> run_(true);
 particle_filter::ParticleFilter particle_filter_;
 ros::Publisher visualization_publisher_;
 ros::Publisher localization_publisher_;
 ros::Publisher laser_publisher_;
 VisualizationMsg vis_msg_;
-sensor_msgs::LaserScan last_laser_msg_;
+// Latest scan, shared with the ROS message queue and the filter thread
+// rather than copied.
+sensor_msgs::LaserScan::ConstPtr last_laser_msg_;
 
 vector<Vector2f> trajectory_points_;
 
+// Laser updates run on a worker thread, so that a slow update does not hold
+// up odometry handling and pose publishing in the ROS callbacks. The
+// callbacks hand the latest odometry and scan to the worker through
+// single-slot mailboxes: if the worker falls behind, older scans are dropped
+// rather than queued. The callbacks all run on the ROS thread, the only
+// producer of both mailboxes.
+struct OdometryReading {
+  Vector2f loc;
+  float angle;
+};
+particle_filter::LatestMailbox<OdometryReading> odom_mailbox_;
+particle_filter::LatestMailbox<sensor_msgs::LaserScan::ConstPtr>
+    laser_mailbox_;
+// Wakes up the worker when a message is posted.
+std::mutex wake_mutex_;
+std::condition_variable wake_cv_;
+bool wake_pending_ = false;
+// Held by the worker while it updates the filter, and by anyone else
+// reading from it.
+std::mutex filter_mutex_;
+std::thread filter_thread_;
+
+// Node-level metrics; the filter records its own per-step latencies.
+metrics::LatencyHistogram* const visualization_latency_ =
+    metrics::GetHistogram("node.publish_visualization");
+std::atomic<int64_t>* const laser_received_ =
+    metrics::GetCounter("node.laser_scans_received");
+std::atomic<int64_t>* const laser_dropped_ =
+    metrics::GetCounter("node.laser_scans_dropped");
+std::atomic<int64_t>* const odom_dropped_ =
+    metrics::GetCounter("node.odometry_dropped");
+// Number of scans waiting in the laser mailbox: 0 or 1.
+std::atomic<int64_t>* const laser_queue_depth_ =
+    metrics::GetCounter("node.laser_queue_depth");
+
+// Latest pose estimate of the filter, with the odometry reading it
+// corresponds to. Published poses extrapolate it with newer odometry, so
+// they never wait for the worker.
+struct PoseSnapshot {
+  bool valid;
+  Vector2f loc;
+  float angle;
+  Vector2f odom_loc;
+  float odom_angle;
+};
+std::mutex pose_mutex_;
+PoseSnapshot pose_snapshot_ = {false, Vector2f(0, 0), 0, Vector2f(0, 0), 0};
+
 void InitializeMsgs() {
   std_msgs::Header header;
   header.frame_id = "map";
@@ -100,10 +175,10 @@ void InitializeMsgs() {
 }
 
 void PublishParticles() {
-  vector<particle_filter::Particle> particles;
-  particle_filter_.GetParticles(&particles);
-  for (const particle_filter::Particle& p : particles) {
-    DrawParticle(p.loc, p.angle, vis_msg_);
+  // Read the particles in place; the caller holds filter_mutex_.
+  const particle_filter::ParticleSet& particles = particle_filter_.Particles();
+  for (size_t i = 0; i < particles.size(); ++i) {
+    DrawParticle(particles.Loc(i), particles.angle[i], vis_msg_);
   }
 }
 
@@ -111,16 +186,18 @@ void PublishPredictedScan() {
   const uint32_t kColor = 0x06990d;
   Vector2f robot_loc(0, 0);
   float robot_angle(0);
+  if (!last_laser_msg_) return;
   particle_filter_.GetLocation(&robot_loc, &robot_angle);
-  vector<Vector2f> predicted_scan;
+  // Reused between frames.
+  static vector<Vector2f> predicted_scan;
   particle_filter_.GetPredictedPointCloud(
       robot_loc,
       robot_angle,
-      last_laser_msg_.ranges.size(),
-      last_laser_msg_.range_min,
-      last_laser_msg_.range_max,
-      last_laser_msg_.angle_min,
-      last_laser_msg_.angle_max,
+      last_laser_msg_->ranges.size(),
+      last_laser_msg_->range_min,
+      last_laser_msg_->range_max,
+      last_laser_msg_->angle_min,
+      last_laser_msg_->angle_max,
       &predicted_scan);
 
   for (const Vector2f& p : predicted_scan) {
@@ -160,7 +237,12 @@ void PublishVisualization() {
     // Rate-limit visualization.
     return;
   }
+  // Reading the particles needs the filter; if the worker is busy updating
+  // it, skip this frame rather than wait.
+  std::unique_lock<std::mutex> filter_lock(filter_mutex_, std::try_to_lock);
+  if (!filter_lock.owns_lock()) return;
   t_last = GetMonotonicTime();
+  metrics::ScopedLatency latency(visualization_latency_);
   vis_msg_.header.stamp = ros::Time::now();
   ClearVisualizationMsg(vis_msg_);
 
@@ -170,19 +252,72 @@ void PublishVisualization() {
   visualization_publisher_.publish(vis_msg_);
 }
 
-void LaserCallback(const sensor_msgs::LaserScan& msg) {
+void WakeFilterThread() {
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    wake_pending_ = true;
+  }
+  wake_cv_.notify_one();
+}
+
+// Worker thread: applies the latest odometry and laser scan to the filter,
+// and publishes the resulting pose estimate to pose_snapshot_.
+void FilterThread() {
+  OdometryReading last_odom = {Vector2f(0, 0), 0};
+  bool have_odom = false;
+  while (run_) {
+    {
+      std::unique_lock<std::mutex> lock(wake_mutex_);
+      wake_cv_.wait_for(lock, std::chrono::milliseconds(100), [] {
+        return wake_pending_ || !run_;
+      });
+      wake_pending_ = false;
+    }
+    OdometryReading odom;
+    const bool new_odom = odom_mailbox_.Take(&odom);
+    sensor_msgs::LaserScan::ConstPtr scan;
+    laser_mailbox_.Take(&scan);
+    *laser_queue_depth_ = laser_mailbox_.Empty() ? 0 : 1;
+    if (!new_odom && !scan) continue;
+    std::lock_guard<std::mutex> filter_lock(filter_mutex_);
+    if (new_odom) {
+      particle_filter_.Predict(odom.loc, odom.angle);
+      last_odom = odom;
+      have_odom = true;
+    }
+    if (scan) {
+      particle_filter_.ObserveLaser(
+          scan->ranges,
+          scan->range_min,
+          scan->range_max,
+          scan->angle_min,
+          scan->angle_max);
+    }
+    PoseSnapshot snapshot;
+    snapshot.valid = have_odom;
+    snapshot.odom_loc = last_odom.loc;
+    snapshot.odom_angle = last_odom.angle;
+    particle_filter_.GetLocation(&snapshot.loc, &snapshot.angle);
+    std::lock_guard<std::mutex> pose_lock(pose_mutex_);
+    pose_snapshot_ = snapshot;
+  }
+}
+
+void LaserCallback(const sensor_msgs::LaserScan::ConstPtr& msg) {
   if (FLAGS_v > 0) {
-    printf("Laser t=%f\n", msg.header.stamp.toSec());
+    printf("Laser t=%f\n", msg->header.stamp.toSec());
   }
   last_laser_msg_ = msg;
-  particle_filter_.ObserveLaser(
-      msg.ranges,
-      msg.range_min,
-      msg.range_max,
-      msg.angle_min,
-      msg.angle_max);
+  ++*laser_received_;
+  if (laser_mailbox_.Post(msg)) {
+    ++*laser_dropped_;
+    if (FLAGS_v > 0) {
+      printf("Dropped a laser scan: the filter is falling behind\n");
+    }
+  }
+  *laser_queue_depth_ = laser_mailbox_.Empty() ? 0 : 1;
+  WakeFilterThread();
   PublishVisualization();
-
 }
 
 void OdometryCallback(const nav_msgs::Odometry& msg) {
@@ -192,10 +327,24 @@ void OdometryCallback(const nav_msgs::Odometry& msg) {
   const Vector2f odom_loc(msg.pose.pose.position.x, msg.pose.pose.position.y);
   const float odom_angle =
       2.0 * atan2(msg.pose.pose.orientation.z, msg.pose.pose.orientation.w);
-  particle_filter_.Predict(odom_loc, odom_angle);
-  Vector2f robot_loc(0, 0);
-  float robot_angle(0);
-  particle_filter_.GetLocation(&robot_loc, &robot_angle);
+  if (odom_mailbox_.Post(OdometryReading({odom_loc, odom_angle}))) {
+    ++*odom_dropped_;
+  }
+  WakeFilterThread();
+  // Extrapolate the latest estimate of the filter by the odometry since.
+  PoseSnapshot snapshot;
+  {
+    std::lock_guard<std::mutex> lock(pose_mutex_);
+    snapshot = pose_snapshot_;
+  }
+  Vector2f robot_loc = snapshot.loc;
+  float robot_angle = snapshot.angle;
+  if (snapshot.valid) {
+    const float delta_angle = AngleDiff(odom_angle, snapshot.odom_angle);
+    robot_loc += Eigen::Rotation2Df(snapshot.angle - snapshot.odom_angle) *
+        (odom_loc - snapshot.odom_loc);
+    robot_angle = AngleMod(snapshot.angle + delta_angle);
+  }
   amrl_msgs::Localization2DMsg localization_msg;
   localization_msg.pose.x = robot_loc.x();
   localization_msg.pose.y = robot_loc.y();
@@ -207,13 +356,38 @@ void OdometryCallback(const nav_msgs::Odometry& msg) {
 void InitCallback(const amrl_msgs::Localization2DMsg& msg) {
   const Vector2f init_loc(msg.pose.x, msg.pose.y);
   const float init_angle = msg.pose.theta;
-  const string map = "maps/" + msg.map + ".txt";
+  const string map = vector_map::MapFile(msg.map);
   printf("Initialize: %s (%f,%f) %f\u00b0\n",
          map.c_str(),
          init_loc.x(),
          init_loc.y(),
          RadToDeg(init_angle));
+  std::lock_guard<std::mutex> filter_lock(filter_mutex_);
+  // Drop any messages from before the reset.
+  odom_mailbox_.Clear();
+  laser_mailbox_.Clear();
   particle_filter_.Initialize(map, init_loc, init_angle);
+  {
+    std::lock_guard<std::mutex> pose_lock(pose_mutex_);
+    pose_snapshot_.valid = false;
+    pose_snapshot_.loc = init_loc;
+    pose_snapshot_.angle = init_angle;
+  }
+  trajectory_points_.clear();
+}
+
+void GlobalInitCallback(const amrl_msgs::Localization2DMsg& msg) {
+  const string map = vector_map::MapFile(msg.map);
+  printf("Initialize globally: %s\n", map.c_str());
+  std::lock_guard<std::mutex> filter_lock(filter_mutex_);
+  // Drop any messages from before the reset.
+  odom_mailbox_.Clear();
+  laser_mailbox_.Clear();
+  particle_filter_.InitializeGlobal(map);
+  {
+    std::lock_guard<std::mutex> pose_lock(pose_mutex_);
+    pose_snapshot_.valid = false;
+  }
   trajectory_points_.clear();
 }
 
@@ -222,6 +396,10 @@ void ProcessLive(ros::NodeHandle* n) {
       FLAGS_init_topic.c_str(),
       1,
       InitCallback);
+  ros::Subscriber global_init_sub = n->subscribe(
+      FLAGS_global_init_topic.c_str(),
+      1,
+      GlobalInitCallback);
   ros::Subscriber laser_sub = n->subscribe(
       FLAGS_laser_topic.c_str(),
       1,
@@ -262,7 +440,24 @@ int main(int argc, char** argv) {
   laser_publisher_ =
       n.advertise<sensor_msgs::LaserScan>("scan", 1);
 
+  vector_map::SetMapDirectory(FLAGS_map_dir);
+  vector_map::SetMapCacheDirectory(CONFIG_map_cache_dir_);
+  if (FLAGS_preload_maps) {
+    printf("Preloaded %d maps from %s\n",
+           vector_map::PreloadMaps(), FLAGS_map_dir.c_str());
+  }
+
+  std::unique_ptr<metrics::MetricsFileWriter> metrics_writer;
+  if (!FLAGS_metrics_file.empty()) {
+    metrics_writer.reset(new metrics::MetricsFileWriter(
+        FLAGS_metrics_file, FLAGS_metrics_period));
+  }
+
+  filter_thread_ = std::thread(FilterThread);
   ProcessLive(&n);
+  run_ = false;
+  WakeFilterThread();
+  filter_thread_.join();
 
   return 0;
 }
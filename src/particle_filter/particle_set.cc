@@ -0,0 +1,191 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    particle_set.cc
+\brief   Structure-of-arrays particle storage, and the data-parallel
+         kernels that operate on it.
+*/
+//========================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "particle_set.h"
+
+using Eigen::Vector2f;
+using std::vector;
+
+// The kernels below are written as flat loops over the aligned arrays, with
+// `omp simd` hints, so that the compiler can vectorize them. The vector width
+// follows the target flags (e.g. -mavx2); the loops that call cos/sin/exp
+// only vectorize when the compiler may use a vector math library
+// (-ffast-math with glibc). Without OpenMP the pragmas are ignored.
+
+namespace particle_filter {
+
+void ParticleSet::GetParticles(vector<Particle>* particles) const {
+  particles->resize(size());
+  for (size_t i = 0; i < size(); ++i) {
+    (*particles)[i] = Get(i);
+  }
+}
+
+void ApplyOdometry(const Vector2f& delta_loc,
+                   float delta_angle,
+                   size_t begin,
+                   size_t end,
+                   ParticleSet* particles) {
+  float* __restrict__ x = particles->x.data();
+  float* __restrict__ y = particles->y.data();
+  float* __restrict__ angle = particles->angle.data();
+  const float dx = delta_loc.x();
+  const float dy = delta_loc.y();
+  #pragma omp simd
+  for (size_t i = begin; i < end; ++i) {
+    const float c = cos(angle[i]);
+    const float s = sin(angle[i]);
+    x[i] += c * dx - s * dy;
+    y[i] += s * dx + c * dy;
+    angle[i] += delta_angle;
+  }
+}
+
+void AddGaussianNoise(const float* noise,
+                      float stddev,
+                      size_t begin,
+                      size_t end,
+                      float* values) {
+  const float* __restrict__ n = noise;
+  float* __restrict__ v = values + begin;
+  #pragma omp simd
+  for (size_t i = 0; i < end - begin; ++i) {
+    v[i] += stddev * n[i];
+  }
+}
+
+double NormalizeLogWeights(ParticleSet* particles) {
+  const size_t n = particles->size();
+  double* __restrict__ log_weight = particles->log_weight.data();
+  double* __restrict__ weight = particles->weight.data();
+  double max_log_weight = -std::numeric_limits<double>::max();
+  #pragma omp simd reduction(max:max_log_weight)
+  for (size_t i = 0; i < n; ++i) {
+    max_log_weight =
+        (log_weight[i] > max_log_weight) ? log_weight[i] : max_log_weight;
+  }
+  double sum = 0;
+  #pragma omp simd reduction(+:sum)
+  for (size_t i = 0; i < n; ++i) {
+    log_weight[i] -= max_log_weight;
+    weight[i] = exp(log_weight[i]);
+    sum += weight[i];
+  }
+  return sum;
+}
+
+double EffectiveSampleSize(const ParticleSet& particles) {
+  const size_t n = particles.size();
+  const double* __restrict__ weight = particles.weight.data();
+  double sum = 0;
+  double sum_squares = 0;
+  #pragma omp simd reduction(+:sum, sum_squares)
+  for (size_t i = 0; i < n; ++i) {
+    sum += weight[i];
+    sum_squares += weight[i] * weight[i];
+  }
+  if (sum_squares <= 0) return 0;
+  return sum * sum / sum_squares;
+}
+
+void EstimatePose(const ParticleSet& particles, PoseEstimate* estimate) {
+  const size_t n = particles.size();
+  const double* __restrict__ weight = particles.weight.data();
+  const float* __restrict__ x = particles.x.data();
+  const float* __restrict__ y = particles.y.data();
+  const float* __restrict__ a = particles.angle.data();
+  double sum_w = 0;
+  double sum_x = 0;
+  double sum_y = 0;
+  double sum_cos = 0;
+  double sum_sin = 0;
+  #pragma omp simd reduction(+:sum_w, sum_x, sum_y, sum_cos, sum_sin)
+  for (size_t i = 0; i < n; ++i) {
+    sum_w += weight[i];
+    sum_x += weight[i] * x[i];
+    sum_y += weight[i] * y[i];
+    sum_cos += weight[i] * cos(a[i]);
+    sum_sin += weight[i] * sin(a[i]);
+  }
+  if (sum_w <= 0) {
+    estimate->loc = Vector2f(0, 0);
+    estimate->angle = 0;
+    estimate->heading = Vector2f(1, 0);
+    estimate->covariance.setZero();
+    return;
+  }
+  const double mean_x = sum_x / sum_w;
+  const double mean_y = sum_y / sum_w;
+  const double mean_a = atan2(sum_sin, sum_cos);
+  estimate->loc = Vector2f(mean_x, mean_y);
+  estimate->angle = mean_a;
+  estimate->heading = Vector2f(sum_cos / sum_w, sum_sin / sum_w);
+
+  // Second pass for the covariance, about the mean.
+  double xx = 0, xy = 0, xa = 0, yy = 0, ya = 0, aa = 0;
+  #pragma omp simd reduction(+:xx, xy, xa, yy, ya, aa)
+  for (size_t i = 0; i < n; ++i) {
+    const double dx = x[i] - mean_x;
+    const double dy = y[i] - mean_y;
+    double da = a[i] - mean_a;
+    da -= 2.0 * M_PI * floor(da / (2.0 * M_PI) + 0.5);
+    xx += weight[i] * dx * dx;
+    xy += weight[i] * dx * dy;
+    xa += weight[i] * dx * da;
+    yy += weight[i] * dy * dy;
+    ya += weight[i] * dy * da;
+    aa += weight[i] * da * da;
+  }
+  Eigen::Matrix3f& c = estimate->covariance;
+  c(0, 0) = xx / sum_w;
+  c(0, 1) = c(1, 0) = xy / sum_w;
+  c(0, 2) = c(2, 0) = xa / sum_w;
+  c(1, 1) = yy / sum_w;
+  c(1, 2) = c(2, 1) = ya / sum_w;
+  c(2, 2) = aa / sum_w;
+}
+
+void ApplyOdometry(const Vector2f& delta_loc,
+                   float delta_angle,
+                   float translation_stddev,
+                   float rotation_stddev,
+                   PoseEstimate* estimate) {
+  // Sum over the particles of w * R(angle) * delta_loc, divided by the sum
+  // of the weights, is R applied to the mean heading vector.
+  const Vector2f& h = estimate->heading;
+  estimate->loc += Vector2f(h.x() * delta_loc.x() - h.y() * delta_loc.y(),
+                            h.y() * delta_loc.x() + h.x() * delta_loc.y());
+  estimate->heading = Eigen::Rotation2Df(delta_angle) * h;
+  estimate->angle = atan2(estimate->heading.y(), estimate->heading.x());
+  const float var_t = translation_stddev * translation_stddev;
+  estimate->covariance(0, 0) += var_t;
+  estimate->covariance(1, 1) += var_t;
+  estimate->covariance(2, 2) += rotation_stddev * rotation_stddev;
+}
+
+}  // namespace particle_filter
@@ -0,0 +1,192 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    particle_set.h
+\brief   Structure-of-arrays particle storage, and the data-parallel
+         kernels that operate on it.
+*/
+//========================================================================
+
+#include <stdlib.h>
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#ifndef SRC_PARTICLE_SET_H_
+#define SRC_PARTICLE_SET_H_
+
+namespace particle_filter {
+
+struct Particle {
+  Eigen::Vector2f loc;
+  float angle;
+  double weight;
+  double log_weight;
+};
+
+// Alignment of the particle arrays, in bytes: one AVX2 register.
+static const size_t kParticleAlignment = 32;
+
+// Allocator for std::vector returning memory aligned to kParticleAlignment.
+template <typename T>
+struct AlignedAllocator {
+  typedef T value_type;
+  AlignedAllocator() {}
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    void* p = nullptr;
+    if (posix_memalign(&p, kParticleAlignment, n * sizeof(T)) != 0) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(p);
+  }
+  void deallocate(T* p, size_t) { free(p); }
+};
+
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) {
+  return false;
+}
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T> >;
+
+// Particles stored as one contiguous, aligned array per field, so that the
+// per-particle loops of the filter can be vectorized.
+struct ParticleSet {
+  AlignedVector<float> x;
+  AlignedVector<float> y;
+  AlignedVector<float> angle;
+  AlignedVector<double> weight;
+  AlignedVector<double> log_weight;
+
+  size_t size() const { return x.size(); }
+  bool empty() const { return x.empty(); }
+
+  void resize(size_t n) {
+    x.resize(n);
+    y.resize(n);
+    angle.resize(n);
+    weight.resize(n);
+    log_weight.resize(n);
+  }
+
+  void clear() { resize(0); }
+
+  void reserve(size_t n) {
+    x.reserve(n);
+    y.reserve(n);
+    angle.reserve(n);
+    weight.reserve(n);
+    log_weight.reserve(n);
+  }
+
+  void push_back(const Particle& p) {
+    x.push_back(p.loc.x());
+    y.push_back(p.loc.y());
+    angle.push_back(p.angle);
+    weight.push_back(p.weight);
+    log_weight.push_back(p.log_weight);
+  }
+
+  // Copy particle i of src into slot j of this set.
+  void CopyFrom(const ParticleSet& src, size_t i, size_t j) {
+    x[j] = src.x[i];
+    y[j] = src.y[i];
+    angle[j] = src.angle[i];
+    weight[j] = src.weight[i];
+    log_weight[j] = src.log_weight[i];
+  }
+
+  Eigen::Vector2f Loc(size_t i) const { return Eigen::Vector2f(x[i], y[i]); }
+
+  // Particle i, as a standalone struct.
+  Particle Get(size_t i) const {
+    Particle p;
+    p.loc = Loc(i);
+    p.angle = angle[i];
+    p.weight = weight[i];
+    p.log_weight = log_weight[i];
+    return p;
+  }
+
+  // Copy the whole set into an array of structs, e.g. for visualization.
+  void GetParticles(std::vector<Particle>* particles) const;
+};
+
+// Move particles [begin, end) by the odometry displacement delta_loc, given
+// in the robot frame, and rotate them by delta_angle.
+void ApplyOdometry(const Eigen::Vector2f& delta_loc,
+                   float delta_angle,
+                   size_t begin,
+                   size_t end,
+                   ParticleSet* particles);
+
+// Add stddev * noise[i - begin] to values[i] for every i in [begin, end).
+// noise holds standard normal samples.
+void AddGaussianNoise(const float* noise,
+                      float stddev,
+                      size_t begin,
+                      size_t end,
+                      float* values);
+
+// Shift the log weights so that the largest is zero, set every weight to the
+// exponential of its log weight, and return the sum of the weights.
+double NormalizeLogWeights(ParticleSet* particles);
+
+// Effective sample size (sum w)^2 / sum w^2 of the particle weights. Expects
+// the weights to be set from the log weights, e.g. by NormalizeLogWeights.
+double EffectiveSampleSize(const ParticleSet& particles);
+
+// Weighted mean pose of a particle set, and its covariance.
+struct PoseEstimate {
+  Eigen::Vector2f loc;
+  // Circular mean of the particle headings.
+  float angle;
+  // Weighted mean of the unit vectors (cos, sin) of the particle headings.
+  // Its length drops from 1 towards 0 as the headings spread out.
+  Eigen::Vector2f heading;
+  // Covariance of (x, y, angle), with the angle deviations wrapped about the
+  // mean angle.
+  Eigen::Matrix3f covariance;
+};
+
+// Weighted mean pose and covariance of the particles. Expects the weights to
+// be set from the log weights, e.g. by NormalizeLogWeights.
+void EstimatePose(const ParticleSet& particles, PoseEstimate* estimate);
+
+// Move a pose estimate by the odometry displacement that ApplyOdometry applies
+// to every particle. The mean of the moved particles is exact, since every
+// particle moves along its own heading and the mean heading vector is known.
+// The covariance is only widened by the given motion noise.
+void ApplyOdometry(const Eigen::Vector2f& delta_loc,
+                   float delta_angle,
+                   float translation_stddev,
+                   float rotation_stddev,
+                   PoseEstimate* estimate);
+
+}  // namespace particle_filter
+
+#endif  // SRC_PARTICLE_SET_H_
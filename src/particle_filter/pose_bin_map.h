@@ -0,0 +1,111 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    pose_bin_map.h
+\brief   Flat hash map from pose histogram bins to small integers.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifndef SRC_POSE_BIN_MAP_H_
+#define SRC_POSE_BIN_MAP_H_
+
+namespace particle_filter {
+
+// Map from the keys of pose histogram bins to small integers, with linear
+// probing in flat arrays. Clear keeps the arrays, so a map that is refilled
+// for every scan stops allocating once it has grown to the largest number
+// of bins seen, unlike std::unordered_map, which allocates a node per key.
+// Every key is valid: the bins of negative coordinates wrap to the top of the
+// key range, so no key is reserved to mark the empty slots.
+class PoseBinMap {
+ public:
+  PoseBinMap() : size_(0) {}
+
+  // Remove every key, keeping the storage.
+  void Clear() {
+    if (size_ == 0) return;
+    std::fill(occupied_.begin(), occupied_.end(), 0);
+    size_ = 0;
+  }
+
+  // Number of keys in the map.
+  size_t size() const { return size_; }
+
+  // Insert key with the given value, unless it is already in the map.
+  // Returns the value stored for the key, and sets *inserted if the key was
+  // new.
+  uint32_t Insert(uint64_t key, uint32_t value, bool* inserted) {
+    // Grow at a load factor of 1/2.
+    if (2 * (size_ + 1) > keys_.size()) Grow();
+    const size_t mask = keys_.size() - 1;
+    for (size_t i = Hash(key) & mask; ; i = (i + 1) & mask) {
+      if (!occupied_[i]) {
+        occupied_[i] = 1;
+        keys_[i] = key;
+        values_[i] = value;
+        ++size_;
+        *inserted = true;
+        return value;
+      }
+      if (keys_[i] == key) {
+        *inserted = false;
+        return values_[i];
+      }
+    }
+  }
+
+ private:
+  // Finalizer of splitmix64: spreads nearby bins over the table.
+  static uint64_t Hash(uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+  }
+
+  // Double the capacity, and re-insert the keys.
+  void Grow() {
+    const size_t capacity = std::max<size_t>(64, 2 * keys_.size());
+    std::vector<uint64_t> keys(capacity);
+    std::vector<uint32_t> values(capacity);
+    std::vector<uint8_t> occupied(capacity, 0);
+    keys.swap(keys_);
+    values.swap(values_);
+    occupied.swap(occupied_);
+    size_ = 0;
+    bool inserted = false;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (occupied[i]) {
+        Insert(keys[i], values[i], &inserted);
+      }
+    }
+  }
+
+  std::vector<uint64_t> keys_;
+  std::vector<uint32_t> values_;
+  // Whether each slot holds a key.
+  std::vector<uint8_t> occupied_;
+  size_t size_;
+};
+
+}  // namespace particle_filter
+
+#endif  // SRC_POSE_BIN_MAP_H_
@@ -0,0 +1,81 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    pose_bin_map_test.cc
+\brief   Checks PoseBinMap against std::map, over bins of negative
+         coordinates and repeated clears.
+*/
+//========================================================================
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <map>
+#include <random>
+
+#include "particle_filter/pose_bin_map.h"
+
+using particle_filter::PoseBinMap;
+
+namespace {
+
+// Key of bin (x, y, t), packed as ParticleFilter packs its pose bins. Bins
+// (-1, -1, -1) give the all-ones key.
+uint64_t Key(int32_t x, int32_t y, int32_t t) {
+  const uint64_t ux = static_cast<int64_t>(x);
+  const uint64_t uy = static_cast<int64_t>(y);
+  const uint64_t ut = static_cast<int64_t>(t);
+  return ((ux & 0xFFFFFF) << 40) | ((uy & 0xFFFFFF) << 16) | (ut & 0xFFFF);
+}
+
+}  // namespace
+
+int main() {
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<int> bin(-3, 2);
+  PoseBinMap map;
+  int errors = 0;
+  // Scans of a few hundred particles about the origin, so that every scan
+  // holds bins with negative coordinates, (-1, -1, -1) among them.
+  for (int scan = 0; scan < 20; ++scan) {
+    map.Clear();
+    std::map<uint64_t, uint32_t> reference;
+    const int num_particles = 50 + 30 * scan;
+    for (int i = 0; i < num_particles; ++i) {
+      const uint64_t key = (i == num_particles / 2) ?
+          Key(-1, -1, -1) : Key(bin(gen), bin(gen), bin(gen));
+      bool inserted = false;
+      const uint32_t value = map.Insert(key, i, &inserted);
+      const auto it = reference.find(key);
+      const bool expect_inserted = (it == reference.end());
+      const uint32_t expect_value = expect_inserted ? i : it->second;
+      if (expect_inserted) reference[key] = i;
+      if (inserted != expect_inserted || value != expect_value) {
+        printf("scan %d, key %016llx: inserted %d value %u, expected "
+               "inserted %d value %u\n", scan,
+               static_cast<unsigned long long>(key), inserted, value,
+               expect_inserted, expect_value);
+        ++errors;
+      }
+    }
+    if (map.size() != reference.size()) {
+      printf("scan %d: %d keys, expected %d\n", scan,
+             static_cast<int>(map.size()), static_cast<int>(reference.size()));
+      ++errors;
+    }
+  }
+  printf("%s\n", (errors == 0) ? "PASS" : "FAIL");
+  return (errors == 0) ? 0 : 1;
+}
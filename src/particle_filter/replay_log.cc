@@ -0,0 +1,134 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    replay_log.cc
+\brief   Plain text log of laser scans and odometry, for replaying the
+         particle filter without ROS.
+*/
+//========================================================================
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "replay_log.h"
+
+using std::string;
+using std::vector;
+
+namespace particle_filter {
+
+bool ReadReplayLog(const string& file, ReplayLog* log) {
+  FILE* fid = fopen(file.c_str(), "r");
+  if (fid == NULL) {
+    fprintf(stderr, "ERROR: Unable to open replay log %s\n", file.c_str());
+    return false;
+  }
+  log->map.clear();
+  log->init_loc = Eigen::Vector2f(0, 0);
+  log->init_angle = 0;
+  log->records.clear();
+  char type[16];
+  int record = 0;
+  bool ok = true;
+  while (ok && fscanf(fid, " %15s", type) == 1) {
+    ++record;
+    if (type[0] == '#') {
+      // Skip the rest of the comment.
+      int c = 0;
+      while ((c = fgetc(fid)) != EOF && c != '\n') {}
+      continue;
+    }
+    ReplayRecord r;
+    float x = 0, y = 0;
+    if (strcmp(type, "map") == 0) {
+      char map[4096];
+      ok = fscanf(fid, " %4095s", map) == 1;
+      log->map = map;
+    } else if (strcmp(type, "init") == 0) {
+      ok = fscanf(fid, "%f %f %f", &x, &y, &log->init_angle) == 3;
+      log->init_loc = Eigen::Vector2f(x, y);
+    } else if (strcmp(type, "odom") == 0 || strcmp(type, "truth") == 0) {
+      r.type = (type[0] == 'o') ? ReplayRecord::kOdometry :
+          ReplayRecord::kReference;
+      ok = fscanf(fid, "%lf %f %f %f", &r.time, &x, &y, &r.angle) == 4;
+      r.loc = Eigen::Vector2f(x, y);
+      log->records.push_back(r);
+    } else if (strcmp(type, "scan") == 0) {
+      r.type = ReplayRecord::kScan;
+      r.loc = Eigen::Vector2f(0, 0);
+      r.angle = 0;
+      int n = 0;
+      ok = fscanf(fid, "%lf %f %f %f %f %d", &r.time, &r.range_min,
+                  &r.range_max, &r.angle_min, &r.angle_max, &n) == 6 && n >= 0;
+      r.ranges.resize(ok ? n : 0);
+      for (int i = 0; ok && i < n; ++i) {
+        ok = fscanf(fid, "%f", &r.ranges[i]) == 1;
+      }
+      log->records.push_back(r);
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      fprintf(stderr, "ERROR: Malformed '%s' record %d in replay log %s\n",
+              type, record, file.c_str());
+    }
+  }
+  fclose(fid);
+  return ok;
+}
+
+bool WriteReplayLog(const string& file, const ReplayLog& log) {
+  FILE* fid = fopen(file.c_str(), "w");
+  if (fid == NULL) {
+    fprintf(stderr, "ERROR: Unable to write replay log %s\n", file.c_str());
+    return false;
+  }
+  fprintf(fid, "# Particle filter replay log, see replay_log.h.\n");
+  fprintf(fid, "map %s\n", log.map.c_str());
+  fprintf(fid, "init %.4f %.4f %.4f\n",
+          log.init_loc.x(), log.init_loc.y(), log.init_angle);
+  for (const ReplayRecord& r : log.records) {
+    switch (r.type) {
+      case ReplayRecord::kOdometry:
+      case ReplayRecord::kReference: {
+        fprintf(fid, "%s %.4f %.4f %.4f %.4f\n",
+                (r.type == ReplayRecord::kOdometry) ? "odom" : "truth",
+                r.time, r.loc.x(), r.loc.y(), r.angle);
+      } break;
+      case ReplayRecord::kScan: {
+        fprintf(fid, "scan %.4f %.3f %.3f %.5f %.5f %d",
+                r.time, r.range_min, r.range_max, r.angle_min, r.angle_max,
+                static_cast<int>(r.ranges.size()));
+        for (const float range : r.ranges) {
+          fprintf(fid, " %.3f", range);
+        }
+        fprintf(fid, "\n");
+      } break;
+    }
+  }
+  const bool ok = (ferror(fid) == 0);
+  fclose(fid);
+  if (!ok) {
+    fprintf(stderr, "ERROR: Failed writing replay log %s\n", file.c_str());
+  }
+  return ok;
+}
+
+}  // namespace particle_filter
@@ -0,0 +1,78 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    replay_log.h
+\brief   Plain text log of laser scans and odometry, for replaying the
+         particle filter without ROS.
+*/
+//========================================================================
+
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#ifndef SRC_REPLAY_LOG_H_
+#define SRC_REPLAY_LOG_H_
+
+namespace particle_filter {
+
+// One line of a replay log. The log is a text file with one record per line,
+// in time order; empty lines and lines starting with '#' are ignored:
+//   map <file>
+//   init <x> <y> <angle>
+//   odom <time> <x> <y> <angle>
+//   truth <time> <x> <y> <angle>
+//   scan <time> <range_min> <range_max> <angle_min> <angle_max> <n> <r_1> .. <r_n>
+// "map" and "init" set the map and initial pose. "odom" is an odometry
+// reading, "truth" the reference pose of the robot at the given time, and
+// "scan" a laser scan. Angles are in radians, and distances in meters.
+struct ReplayRecord {
+  enum Type {
+    kOdometry,
+    kReference,
+    kScan,
+  };
+  Type type = kOdometry;
+  double time = 0;
+  // Pose of odometry and reference records.
+  Eigen::Vector2f loc = Eigen::Vector2f::Zero();
+  float angle = 0;
+  // Laser scan.
+  float range_min = 0;
+  float range_max = 0;
+  float angle_min = 0;
+  float angle_max = 0;
+  std::vector<float> ranges;
+};
+
+struct ReplayLog {
+  // Map file, and initial pose of the robot.
+  std::string map;
+  Eigen::Vector2f init_loc;
+  float init_angle;
+  std::vector<ReplayRecord> records;
+};
+
+// Read a replay log. Returns false and prints an error if the file cannot be
+// read or is malformed.
+bool ReadReplayLog(const std::string& file, ReplayLog* log);
+
+// Write a replay log. Returns false and prints an error on failure.
+bool WriteReplayLog(const std::string& file, const ReplayLog& log);
+
+}  // namespace particle_filter
+
+#endif  // SRC_REPLAY_LOG_H_
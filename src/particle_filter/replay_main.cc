@@ -0,0 +1,192 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    replay_main.cc
+\brief   Replays a scan and odometry log through the particle filter as fast
+         as possible, and reports throughput, latency and pose error. Does
+         not depend on ROS.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "gflags/gflags.h"
+#include "config_reader/config_reader.h"
+#include "shared/math/math_util.h"
+#include "shared/util/timer.h"
+#include "metrics/metrics.h"
+#include "particle_filter.h"
+#include "replay_log.h"
+
+using math_util::AngleDiff;
+using math_util::RadToDeg;
+using particle_filter::ReplayLog;
+using particle_filter::ReplayRecord;
+using std::string;
+using std::vector;
+using Eigen::Vector2f;
+
+DEFINE_string(log, "logs/GDC1_synthetic.log", "Replay log to run");
+DEFINE_string(config, "config/particle_filter.lua", "Particle filter config");
+DEFINE_int32(repeat, 1, "Number of times to replay the log");
+DEFINE_bool(global, false,
+            "Localize globally from the first scan, instead of starting at "
+            "the initial pose of the log");
+DEFINE_string(metrics_file, "",
+              "File to write the per-step latency metrics of the filter to, "
+              "as JSON");
+
+namespace {
+
+// Print the percentiles of a list of latencies, in milliseconds.
+void PrintLatency(const char* name, vector<double> t) {
+  if (t.empty()) {
+    printf("%-8s no samples\n", name);
+    return;
+  }
+  std::sort(t.begin(), t.end());
+  const size_t n = t.size();
+  printf("%-8s p50 %8.3f  p90 %8.3f  p99 %8.3f  max %8.3f ms  (%lu samples)\n",
+         name,
+         1e3 * t[n / 2],
+         1e3 * t[(n * 9) / 10],
+         1e3 * t[(n * 99) / 100],
+         1e3 * t[n - 1],
+         n);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  config_reader::ConfigReader config_reader({FLAGS_config});
+
+  ReplayLog log;
+  if (!ReadReplayLog(FLAGS_log, &log)) return 1;
+  size_t num_scans = 0;
+  for (const ReplayRecord& r : log.records) {
+    if (r.type == ReplayRecord::kScan) ++num_scans;
+  }
+  printf("Replaying %s: %lu records, %lu scans, map %s\n",
+         FLAGS_log.c_str(), log.records.size(), num_scans, log.map.c_str());
+
+  vector<double> predict_times;
+  vector<double> update_times;
+  vector<double> location_times;
+  // Latency of the first scan, which runs the global search with --global.
+  vector<double> first_scan_times;
+  double total_time = 0;
+  uint64_t cache_hits = 0;
+  uint64_t cache_misses = 0;
+  // Pose error after every scan, against the latest reference pose.
+  vector<double> loc_errors;
+  vector<double> angle_errors;
+  for (int k = 0; k < FLAGS_repeat; ++k) {
+    particle_filter::ParticleFilter filter;
+    if (FLAGS_global) {
+      filter.InitializeGlobal(log.map);
+    } else {
+      filter.Initialize(log.map, log.init_loc, log.init_angle);
+    }
+    const ReplayRecord* reference = nullptr;
+    const double t_start = GetMonotonicTime();
+    for (const ReplayRecord& r : log.records) {
+      switch (r.type) {
+        case ReplayRecord::kOdometry: {
+          const double t0 = GetMonotonicTime();
+          filter.Predict(r.loc, r.angle);
+          predict_times.push_back(GetMonotonicTime() - t0);
+        } break;
+        case ReplayRecord::kReference: {
+          reference = &r;
+        } break;
+        case ReplayRecord::kScan: {
+          double t0 = GetMonotonicTime();
+          filter.ObserveLaser(r.ranges,
+                              r.range_min,
+                              r.range_max,
+                              r.angle_min,
+                              r.angle_max);
+          if (first_scan_times.size() < static_cast<size_t>(k + 1)) {
+            first_scan_times.push_back(GetMonotonicTime() - t0);
+          } else {
+            update_times.push_back(GetMonotonicTime() - t0);
+          }
+          Vector2f loc(0, 0);
+          float angle = 0;
+          t0 = GetMonotonicTime();
+          filter.GetLocation(&loc, &angle);
+          location_times.push_back(GetMonotonicTime() - t0);
+          if (reference != nullptr) {
+            loc_errors.push_back((loc - reference->loc).norm());
+            angle_errors.push_back(fabs(AngleDiff(angle, reference->angle)));
+          }
+        } break;
+      }
+    }
+    total_time += GetMonotonicTime() - t_start;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    filter.GetScanCacheStats(&hits, &misses);
+    cache_hits += hits;
+    cache_misses += misses;
+  }
+
+  printf("\nThroughput: %.1f scans/s (%.3f s total)\n",
+         FLAGS_repeat * num_scans / total_time, total_time);
+  printf("Predicted scans: %lu cache hits, %lu ray cast (%.1f%% hit rate)\n",
+         cache_hits, cache_misses,
+         100.0 * cache_hits / std::max<uint64_t>(1, cache_hits + cache_misses));
+  printf("\nLatency:\n");
+  PrintLatency("predict", predict_times);
+  PrintLatency("update", update_times);
+  PrintLatency("locate", location_times);
+  PrintLatency("first", first_scan_times);
+  if (!loc_errors.empty()) {
+    double sq_loc = 0;
+    double sq_angle = 0;
+    for (size_t i = 0; i < loc_errors.size(); ++i) {
+      sq_loc += loc_errors[i] * loc_errors[i];
+      sq_angle += angle_errors[i] * angle_errors[i];
+    }
+    printf("\nPose error over %lu scans:\n", loc_errors.size());
+    printf("location  RMS %7.3f m    max %7.3f m    final %7.3f m\n",
+           sqrt(sq_loc / loc_errors.size()),
+           *std::max_element(loc_errors.begin(), loc_errors.end()),
+           loc_errors.back());
+    printf("angle     RMS %7.3f deg  max %7.3f deg  final %7.3f deg\n",
+           RadToDeg(sqrt(sq_angle / angle_errors.size())),
+           RadToDeg(*std::max_element(angle_errors.begin(),
+                                      angle_errors.end())),
+           RadToDeg(angle_errors.back()));
+  }
+  if (!FLAGS_metrics_file.empty()) {
+    FILE* fid = fopen(FLAGS_metrics_file.c_str(), "w");
+    if (fid == nullptr) {
+      printf("Unable to write %s\n", FLAGS_metrics_file.c_str());
+      return 1;
+    }
+    fputs(metrics::MetricsJSON().c_str(), fid);
+    fclose(fid);
+  }
+  return 0;
+}
@@ -0,0 +1,100 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    beam_directions.cc
+\brief   Precomputed unit direction vectors of the beams of a laser scan,
+         shared process-wide by scan geometry.
+*/
+//========================================================================
+
+#include <math.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+#include "beam_directions.h"
+
+namespace {
+
+typedef std::tuple<float, float, int> GeometryKey;
+
+// Tables built so far, by scan geometry.
+struct Registry {
+  std::mutex mutex;
+  std::map<GeometryKey,
+           std::shared_ptr<const scan_geometry::BeamDirections> > tables;
+};
+
+Registry& GetRegistry() {
+  static Registry* registry = new Registry();
+  return *registry;
+}
+
+// Bound on the number of geometries kept. A robot has a handful of lasers;
+// past this, the geometry is changing from scan to scan (e.g. a driver that
+// reports jittering angle limits) and keeping old tables would only leak.
+const size_t kMaxTables = 16;
+
+}  // namespace
+
+namespace scan_geometry {
+
+std::shared_ptr<const BeamDirections> GetBeamDirections(float angle_min,
+                                                        float angle_max,
+                                                        int num_beams) {
+  if (num_beams < 0) num_beams = 0;
+  Registry& registry = GetRegistry();
+  const GeometryKey key(angle_min, angle_max, num_beams);
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  std::shared_ptr<const BeamDirections>& table = registry.tables[key];
+  if (table) return table;
+
+  std::shared_ptr<BeamDirections> directions(new BeamDirections());
+  directions->angle_min = angle_min;
+  directions->angle_max = angle_max;
+  directions->num_beams = num_beams;
+  directions->cos_angle.resize(num_beams);
+  directions->sin_angle.resize(num_beams);
+  const double angle_increment =
+      (static_cast<double>(angle_max) - angle_min) / num_beams;
+  for (int i = 0; i < num_beams; ++i) {
+    const double a = angle_min + i * angle_increment;
+    directions->cos_angle[i] = cos(a);
+    directions->sin_angle[i] = sin(a);
+  }
+  if (registry.tables.size() > kMaxTables) {
+    // Tables still held by callers stay valid.
+    registry.tables.clear();
+    registry.tables[key] = directions;
+    return directions;
+  }
+  table = directions;
+  return table;
+}
+
+const BeamDirections& UpdateBeamDirections(
+    float angle_min,
+    float angle_max,
+    int num_beams,
+    std::shared_ptr<const BeamDirections>* table) {
+  if (!*table || !(*table)->Matches(angle_min, angle_max, num_beams)) {
+    *table = GetBeamDirections(angle_min, angle_max, num_beams);
+  }
+  return **table;
+}
+
+}  // namespace scan_geometry
@@ -0,0 +1,83 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    beam_directions.h
+\brief   Precomputed unit direction vectors of the beams of a laser scan,
+         shared process-wide by scan geometry.
+*/
+//========================================================================
+
+#include <memory>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#ifndef SRC_BEAM_DIRECTIONS_H_
+#define SRC_BEAM_DIRECTIONS_H_
+
+namespace scan_geometry {
+
+// Unit direction vectors of the beams of a scan, in the laser frame. Beam i
+// points at angle_min + i * (angle_max - angle_min) / num_beams, the beam
+// spacing used by the filter and SLAM.
+struct BeamDirections {
+  float angle_min;
+  float angle_max;
+  int num_beams;
+  // Cosine and sine of the angle of every beam.
+  std::vector<float> cos_angle;
+  std::vector<float> sin_angle;
+
+  bool Matches(float min, float max, int n) const {
+    return min == angle_min && max == angle_max && n == num_beams;
+  }
+
+  // Angle of beam i, relative to the laser heading.
+  float Angle(int i) const {
+    return angle_min + i * (angle_max - angle_min) / num_beams;
+  }
+
+  // Direction of beam i in the laser frame.
+  Eigen::Vector2f Direction(int i) const {
+    return Eigen::Vector2f(cos_angle[i], sin_angle[i]);
+  }
+
+  // Direction of beam i for a laser heading with cosine c and sine s, by
+  // angle addition rather than a cos / sin call per beam.
+  Eigen::Vector2f Rotated(int i, float c, float s) const {
+    return Eigen::Vector2f(c * cos_angle[i] - s * sin_angle[i],
+                           s * cos_angle[i] + c * sin_angle[i]);
+  }
+};
+
+// The directions table for a scan geometry, built on first use and shared by
+// every caller with the same geometry. Thread-safe. Tables are immutable, and
+// stay valid for as long as they are held.
+std::shared_ptr<const BeamDirections> GetBeamDirections(float angle_min,
+                                                        float angle_max,
+                                                        int num_beams);
+
+// Point *table at the directions table for the scan geometry, looking it up
+// only if the geometry changed since the last call, and return it. Scans
+// rarely change geometry, so this is the per-scan entry point.
+const BeamDirections& UpdateBeamDirections(
+    float angle_min,
+    float angle_max,
+    int num_beams,
+    std::shared_ptr<const BeamDirections>* table);
+
+}  // namespace scan_geometry
+
+#endif  // SRC_BEAM_DIRECTIONS_H_
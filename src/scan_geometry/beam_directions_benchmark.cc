@@ -0,0 +1,326 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    beam_directions_benchmark.cc
+\brief   Micro-benchmark of the per-beam loops of the filter, SLAM and
+         navigation, computing beam directions with cos / sin per beam
+         against the shared BeamDirections tables.
+*/
+//========================================================================
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "eigen3/Eigen/Geometry"
+
+#include "shared/math/line2d.h"
+#include "shared/math/math_util.h"
+#include "shared/util/timer.h"
+#include "scan_geometry/beam_directions.h"
+#include "vector_map/cddt.h"
+
+using Eigen::Rotation2Df;
+using Eigen::Vector2f;
+using geometry::line2f;
+using math_util::AngleDiff;
+using scan_geometry::BeamDirections;
+using std::vector;
+
+namespace {
+
+// Scan geometry of a 270 degree, quarter degree laser.
+const int kNumBeams = 1081;
+const float kAngleMin = -0.75 * M_PI;
+const float kAngleMax = 0.75 * M_PI;
+const float kRangeMin = 0.02;
+const float kRangeMax = 10.0;
+// The filter scores every kRatio-th beam, and SLAM every kSkip-th.
+const int kRatio = 10;
+const int kSkip = 10;
+const int kNumParticles = 1000;
+const int kNumPoses = 3 * 3 * 30;
+// Grid standing in for the distance field and the SLAM likelihood table.
+const float kGridResolution = 0.02;
+const int kGridSize = 1024;
+
+float GridLookup(const vector<float>& grid, const Vector2f& p) {
+  const int x = std::min(kGridSize - 1, std::max(0,
+      static_cast<int>(p.x() / kGridResolution) + kGridSize / 2));
+  const int y = std::min(kGridSize - 1, std::max(0,
+      static_cast<int>(p.y() / kGridResolution) + kGridSize / 2));
+  return grid[x * kGridSize + y];
+}
+
+struct Loop {
+  const char* name;
+  double t_reference;
+  double t_table;
+  double max_error;
+};
+
+void Report(const Loop& loop, double num_iterations) {
+  printf("%-28s %9.1f us %9.1f us  %4.1fx  trig share %4.1f%%  "
+         "max diff %g\n",
+         loop.name,
+         1e6 * loop.t_reference / num_iterations,
+         1e6 * loop.t_table / num_iterations,
+         loop.t_reference / loop.t_table,
+         100.0 * (1.0 - loop.t_table / loop.t_reference),
+         loop.max_error);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int kRepeats = 20;
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> range_dist(kRangeMin, kRangeMax);
+  std::uniform_real_distribution<float> xy_dist(-1, 1);
+  std::uniform_real_distribution<float> angle_dist(-M_PI, M_PI);
+
+  vector<float> ranges(kNumBeams);
+  for (float& r : ranges) r = range_dist(gen);
+  // A smooth field, so that endpoints that round into neighboring cells
+  // change the scores only slightly.
+  vector<float> grid(kGridSize * kGridSize);
+  for (int x = 0; x < kGridSize; ++x) {
+    for (int y = 0; y < kGridSize; ++y) {
+      grid[x * kGridSize + y] = -0.5 * (1 + sin(0.05 * x) * cos(0.05 * y));
+    }
+  }
+  vector<Vector2f> particle_loc(kNumParticles);
+  vector<float> particle_angle(kNumParticles);
+  for (int i = 0; i < kNumParticles; ++i) {
+    particle_loc[i] = Vector2f(xy_dist(gen), xy_dist(gen));
+    particle_angle[i] = 0.1 * angle_dist(gen);
+  }
+  // A 20 m square room with random interior walls, for the CDDT loop.
+  vector<line2f> lines;
+  lines.push_back(line2f(-10, -10, 10, -10));
+  lines.push_back(line2f(10, -10, 10, 10));
+  lines.push_back(line2f(10, 10, -10, 10));
+  lines.push_back(line2f(-10, 10, -10, -10));
+  for (int i = 0; i < 200; ++i) {
+    const Vector2f p(9 * xy_dist(gen), 9 * xy_dist(gen));
+    const float a = angle_dist(gen);
+    lines.push_back(line2f(p, p + Vector2f(cos(a), sin(a))));
+  }
+  vector_map::CDDT cddt;
+  cddt.Build(lines, "", 0.05, 180, nullptr);
+
+  const BeamDirections& directions = *scan_geometry::GetBeamDirections(
+      kAngleMin, kAngleMax, kNumBeams);
+  const float angle_increment = (kAngleMax - kAngleMin) / kNumBeams;
+  vector<int> beam_indices;
+  for (int i = 0; i < kNumBeams / kRatio; ++i) beam_indices.push_back(i * kRatio);
+  vector<float> beam_angles, beam_cos, beam_sin;
+  for (const int i : beam_indices) {
+    beam_angles.push_back(kAngleMin + i * angle_increment);
+    beam_cos.push_back(directions.cos_angle[i]);
+    beam_sin.push_back(directions.sin_angle[i]);
+  }
+  const int num_scored = beam_indices.size();
+  double checksum = 0;
+  vector<Loop> loops;
+
+  // ParticleFilter::Update with the likelihood field model: every scored beam
+  // endpoint of every particle.
+  {
+    Loop loop = {"likelihood field update", 0, 0, 0};
+    vector<double> reference(kNumParticles), table(kNumParticles);
+    double t_start = GetMonotonicTime();
+    for (int k = 0; k < kRepeats; ++k) {
+      for (int p = 0; p < kNumParticles; ++p) {
+        const float angle = particle_angle[p];
+        const Vector2f lazer_loc =
+            particle_loc[p] + 0.2 * Vector2f(cos(angle), sin(angle));
+        double log_prob = 0;
+        for (const int i : beam_indices) {
+          const float a = angle + kAngleMin + i * angle_increment;
+          const Vector2f endpoint =
+              lazer_loc + ranges[i] * Vector2f(cos(a), sin(a));
+          log_prob += GridLookup(grid, endpoint);
+        }
+        reference[p] = log_prob;
+      }
+    }
+    loop.t_reference = GetMonotonicTime() - t_start;
+    t_start = GetMonotonicTime();
+    for (int k = 0; k < kRepeats; ++k) {
+      for (int p = 0; p < kNumParticles; ++p) {
+        const float c = cos(particle_angle[p]);
+        const float s = sin(particle_angle[p]);
+        const Vector2f lazer_loc = particle_loc[p] + 0.2 * Vector2f(c, s);
+        double log_prob = 0;
+        for (int j = 0; j < num_scored; ++j) {
+          const Vector2f dir(c * beam_cos[j] - s * beam_sin[j],
+                             s * beam_cos[j] + c * beam_sin[j]);
+          log_prob += GridLookup(grid, lazer_loc + ranges[beam_indices[j]] * dir);
+        }
+        table[p] = log_prob;
+      }
+    }
+    loop.t_table = GetMonotonicTime() - t_start;
+    for (int p = 0; p < kNumParticles; ++p) {
+      loop.max_error = std::max(loop.max_error, fabs(reference[p] - table[p]));
+      checksum += table[p];
+    }
+    loops.push_back(loop);
+  }
+
+  // ParticleFilter::PredictRanges with the CDDT table.
+  {
+    Loop loop = {"CDDT predicted ranges", 0, 0, 0};
+    vector<float> reference(kNumParticles * num_scored);
+    vector<float> table(kNumParticles * num_scored);
+    double t_start = GetMonotonicTime();
+    for (int k = 0; k < kRepeats; ++k) {
+      for (int p = 0; p < kNumParticles; ++p) {
+        for (int j = 0; j < num_scored; ++j) {
+          const float a = particle_angle[p] + beam_angles[j];
+          const Vector2f dir(cos(a), sin(a));
+          reference[p * num_scored + j] = kRangeMin + cddt.Range(
+              particle_loc[p] + kRangeMin * dir, a, kRangeMax - kRangeMin);
+        }
+      }
+    }
+    loop.t_reference = GetMonotonicTime() - t_start;
+    t_start = GetMonotonicTime();
+    for (int k = 0; k < kRepeats; ++k) {
+      for (int p = 0; p < kNumParticles; ++p) {
+        const float c = cos(particle_angle[p]);
+        const float s = sin(particle_angle[p]);
+        for (int j = 0; j < num_scored; ++j) {
+          const float a = particle_angle[p] + beam_angles[j];
+          const Vector2f dir(c * beam_cos[j] - s * beam_sin[j],
+                             s * beam_cos[j] + c * beam_sin[j]);
+          table[p * num_scored + j] = kRangeMin + cddt.Range(
+              particle_loc[p] + kRangeMin * dir, a, kRangeMax - kRangeMin);
+        }
+      }
+    }
+    loop.t_table = GetMonotonicTime() - t_start;
+    for (size_t i = 0; i < table.size(); ++i) {
+      loop.max_error = std::max<double>(loop.max_error,
+                                        fabs(reference[i] - table[i]));
+      checksum += table[i];
+    }
+    loops.push_back(loop);
+  }
+
+  // SLAM::CorrelativeScanMatching: every scored beam endpoint, transformed
+  // into the previous scan's frame for every candidate pose.
+  {
+    Loop loop = {"SLAM correlative matching", 0, 0, 0};
+    const float best_angle = 0.3;
+    const Vector2f best_loc(0.5, -0.2);
+    vector<double> reference(kNumPoses), table(kNumPoses);
+    double t_start = GetMonotonicTime();
+    for (int k = 0; k < kRepeats; ++k) {
+      for (int p = 0; p < kNumPoses; ++p) {
+        double log_prob = 0;
+        float cur_angle = kAngleMin;
+        for (int j = 0; j < kNumBeams; j += kSkip) {
+          const Vector2f point(ranges[j] * cos(cur_angle) + 0.2,
+                               ranges[j] * sin(cur_angle));
+          const Rotation2Df new_link_old_link(
+              AngleDiff(particle_angle[p], best_angle));
+          const Rotation2Df map_old_link(-best_angle);
+          const Vector2f query = map_old_link * (particle_loc[p] - best_loc) +
+              new_link_old_link * point;
+          log_prob += GridLookup(grid, query);
+          cur_angle += angle_increment * kSkip;
+        }
+        reference[p] = log_prob;
+      }
+    }
+    loop.t_reference = GetMonotonicTime() - t_start;
+    t_start = GetMonotonicTime();
+    for (int k = 0; k < kRepeats; ++k) {
+      vector<Vector2f> points;
+      for (int j = 0; j < kNumBeams; j += kSkip) {
+        points.push_back(ranges[j] * directions.Direction(j) +
+                         Vector2f(0.2, 0));
+      }
+      const Rotation2Df map_old_link(-best_angle);
+      for (int p = 0; p < kNumPoses; ++p) {
+        const Eigen::Matrix2f rotation = Rotation2Df(
+            AngleDiff(particle_angle[p], best_angle)).toRotationMatrix();
+        const Vector2f translation =
+            map_old_link * (particle_loc[p] - best_loc);
+        double log_prob = 0;
+        for (const Vector2f& point : points) {
+          log_prob += GridLookup(grid, translation + rotation * point);
+        }
+        table[p] = log_prob;
+      }
+    }
+    loop.t_table = GetMonotonicTime() - t_start;
+    for (int p = 0; p < kNumPoses; ++p) {
+      loop.max_error = std::max(loop.max_error, fabs(reference[p] - table[p]));
+      checksum += table[p];
+    }
+    loops.push_back(loop);
+  }
+
+  // The navigation node's LaserCallback and SLAM::add_new_points_in_map:
+  // every beam endpoint of the scan, in the robot or the map frame.
+  {
+    Loop loop = {"scan to point cloud", 0, 0, 0};
+    const float heading = 0.7;
+    const Vector2f loc(1, 2);
+    vector<Vector2f> reference(kNumBeams), table(kNumBeams);
+    const int kCloudRepeats = kRepeats * kNumParticles / 10;
+    double t_start = GetMonotonicTime();
+    for (int k = 0; k < kCloudRepeats; ++k) {
+      for (int i = 0; i < kNumBeams; ++i) {
+        const float a = heading + kAngleMin + i * angle_increment;
+        reference[i] = loc + ranges[i] * Vector2f(cos(a), sin(a));
+      }
+      checksum += reference[k % kNumBeams].x();
+    }
+    loop.t_reference = GetMonotonicTime() - t_start;
+    t_start = GetMonotonicTime();
+    for (int k = 0; k < kCloudRepeats; ++k) {
+      const float c = cos(heading);
+      const float s = sin(heading);
+      for (int i = 0; i < kNumBeams; ++i) {
+        table[i] = loc + ranges[i] * directions.Rotated(i, c, s);
+      }
+      checksum += table[k % kNumBeams].x();
+    }
+    loop.t_table = GetMonotonicTime() - t_start;
+    for (int i = 0; i < kNumBeams; ++i) {
+      loop.max_error = std::max<double>(loop.max_error,
+                                        (reference[i] - table[i]).norm());
+    }
+    // Reported per scan of kNumParticles / 10 clouds, like the other loops.
+    loop.t_reference *= 10.0 / kNumParticles;
+    loop.t_table *= 10.0 / kNumParticles;
+    loops.push_back(loop);
+  }
+
+  printf("Beams: %d, scored: %d, particles: %d, SLAM poses: %d\n",
+         kNumBeams, num_scored, kNumParticles, kNumPoses);
+  printf("%-28s %12s %12s\n", "Loop (per scan)", "cos / sin", "table");
+  for (const Loop& loop : loops) Report(loop, kRepeats);
+  printf("(checksum %g)\n", checksum);
+  return 0;
+}
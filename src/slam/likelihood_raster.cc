@@ -0,0 +1,304 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    likelihood_raster.cc
+\brief   Flat, robot-centred rolling raster of observation log likelihoods
+         for correlative scan matching, built by stamping a precomputed
+         kernel about every point.
+*/
+//========================================================================
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cmath>
+#include <new>
+
+#include "eigen3/Eigen/Dense"
+
+#include "likelihood_raster.h"
+
+using Eigen::Vector2f;
+
+namespace {
+
+// Alignment of the rows, in bytes: one cache line.
+const size_t kCacheLine = 64;
+const int kCellsPerLine = kCacheLine / sizeof(float);
+static_assert(slam::kTileSize % kCellsPerLine == 0,
+              "Tiles must be whole cache lines wide");
+
+// Largest multiple of kTileSize not above x.
+int FloorToTile(int x) {
+  return (x >= 0 ? x : x - slam::kTileSize + 1) / slam::kTileSize *
+      slam::kTileSize;
+}
+
+}  // namespace
+
+namespace slam {
+
+LikelihoodRaster::LikelihoodRaster() :
+    resolution_(1),
+    width_(0),
+    height_(0),
+    min_x_(0),
+    min_y_(0),
+    offset_x_(0),
+    offset_y_(0),
+    kernel_radius_(0),
+    tiles_x_(0) {}
+
+void LikelihoodRaster::Init(const Vector2f& min,
+                            const Vector2f& max,
+                            float resolution,
+                            int kernel_radius,
+                            float variance) {
+  resolution_ = resolution;
+  const int min_x = FloorToTile(CellX(min.x()));
+  const int min_y = FloorToTile(CellY(min.y()));
+  const int width = std::max(kTileSize,
+      (CellX(max.x()) - min_x + kTileSize - 1) / kTileSize * kTileSize);
+  const int height = std::max(kTileSize,
+      (CellY(max.y()) - min_y + kTileSize - 1) / kTileSize * kTileSize);
+  if (!cells_ || width != width_ || height != height_) {
+    void* p = nullptr;
+    const size_t size = static_cast<size_t>(width) * height;
+    if (posix_memalign(&p, kCacheLine, size * sizeof(float)) != 0) {
+      throw std::bad_alloc();
+    }
+    cells_.reset(static_cast<float*>(p));
+    std::fill(cells_.get(), cells_.get() + size, kEmptyLikelihood);
+    for (int k = 1; k <= kPyramidLevels; ++k) {
+      levels_[k].assign((width >> k) * (height >> k), kEmptyLikelihood);
+    }
+    width_ = width;
+    height_ = height;
+    tiles_x_ = width / kTileSize;
+    tile_dirty_.assign(tiles_x_ * (height / kTileSize), 0);
+    dirty_tiles_.clear();
+    tile_stale_.assign(tile_dirty_.size(), 0);
+    stale_tiles_.clear();
+  } else {
+    Clear();
+  }
+  min_x_ = min_x;
+  min_y_ = min_y;
+  offset_x_ = 0;
+  offset_y_ = 0;
+
+  kernel_radius_ = std::max(0, kernel_radius);
+  const int size = 2 * kernel_radius_ + 1;
+  kernel_.resize(size * size);
+  for (int dy = -kernel_radius_; dy <= kernel_radius_; ++dy) {
+    for (int dx = -kernel_radius_; dx <= kernel_radius_; ++dx) {
+      const float ex = dx * resolution;
+      const float ey = dy * resolution;
+      kernel_[(dy + kernel_radius_) * size + dx + kernel_radius_] =
+          -(pow(ex, 2) + pow(ey, 2)) / variance;
+    }
+  }
+}
+
+void LikelihoodRaster::Clear() {
+  for (const int tile : dirty_tiles_) {
+    const int x = (tile % tiles_x_) * kTileSize;
+    const int y = (tile / tiles_x_) * kTileSize;
+    for (int row = y; row < y + kTileSize; ++row) {
+      float* cells = cells_.get() + row * width_ + x;
+      std::fill(cells, cells + kTileSize, kEmptyLikelihood);
+    }
+    ClearBlocks(x, y, x + kTileSize, y + kTileSize);
+    tile_dirty_[tile] = 0;
+  }
+  dirty_tiles_.clear();
+}
+
+void LikelihoodRaster::MarkDirty(int first, int last) {
+  for (int tile = first; tile <= last; ++tile) {
+    if (!tile_dirty_[tile]) {
+      tile_dirty_[tile] = 1;
+      dirty_tiles_.push_back(tile);
+    }
+    if (!tile_stale_[tile]) {
+      tile_stale_[tile] = 1;
+      stale_tiles_.push_back(tile);
+    }
+  }
+}
+
+void LikelihoodRaster::UpdatePyramid() {
+  for (const int tile : stale_tiles_) {
+    const int x = (tile % tiles_x_) * kTileSize;
+    const int y = (tile / tiles_x_) * kTileSize;
+    // Each level of the tile from the one below it.
+    for (int k = 1; k <= kPyramidLevels; ++k) {
+      const float* below = (k == 1) ? cells_.get() : levels_[k - 1].data();
+      const int below_width = width_ >> (k - 1);
+      const int level_width = width_ >> k;
+      for (int by = y >> k; by < (y + kTileSize) >> k; ++by) {
+        const float* row0 = below + 2 * by * below_width;
+        const float* row1 = row0 + below_width;
+        float* blocks = levels_[k].data() + by * level_width;
+        for (int bx = x >> k; bx < (x + kTileSize) >> k; ++bx) {
+          blocks[bx] = std::max(std::max(row0[2 * bx], row0[2 * bx + 1]),
+                                std::max(row1[2 * bx], row1[2 * bx + 1]));
+        }
+      }
+    }
+    tile_stale_[tile] = 0;
+  }
+  stale_tiles_.clear();
+}
+
+void LikelihoodRaster::ClearBlocks(int x0, int y0, int x1, int y1) {
+  for (int k = 1; k <= kPyramidLevels; ++k) {
+    const int level_width = width_ >> k;
+    for (int by = y0 >> k; by < (y1 >> k); ++by) {
+      float* blocks = levels_[k].data() + by * level_width;
+      std::fill(blocks + (x0 >> k), blocks + (x1 >> k), kEmptyLikelihood);
+    }
+  }
+}
+
+void LikelihoodRaster::ClearColumns(int begin, int end) {
+  // Window columns [begin, end) are at most two runs of storage columns.
+  const int first = Column(begin);
+  const int n = end - begin;
+  const int n1 = std::min(n, width_ - first);
+  for (int y = 0; y < height_; ++y) {
+    float* row = cells_.get() + y * width_;
+    std::fill(row + first, row + first + n1, kEmptyLikelihood);
+    std::fill(row, row + (n - n1), kEmptyLikelihood);
+  }
+  ClearBlocks(first, 0, first + n1, height_);
+  ClearBlocks(0, 0, n - n1, height_);
+}
+
+void LikelihoodRaster::ClearRows(int begin, int end) {
+  for (int y = begin; y < end; y += kTileSize) {
+    const int row = StorageRow(y);
+    std::fill(cells_.get() + row * width_,
+              cells_.get() + (row + kTileSize) * width_,
+              kEmptyLikelihood);
+    ClearBlocks(0, row, width_, row + kTileSize);
+  }
+}
+
+float LikelihoodRaster::MaxInRect(int x0, int y0, int x1, int y1) const {
+  x0 = std::max(x0 - min_x_, 0);
+  y0 = std::max(y0 - min_y_, 0);
+  x1 = std::min(x1 - min_x_, width_ - 1);
+  y1 = std::min(y1 - min_y_, height_ - 1);
+  if (x0 > x1 || y0 > y1) return kEmptyLikelihood;
+  // The lowest level whose blocks are as large as the rectangle, so that it
+  // overlaps at most two blocks each way.
+  const int span = std::max(x1 - x0, y1 - y0) + 1;
+  int k = 0;
+  while (k < kPyramidLevels && (1 << k) < span) ++k;
+  const float* level = (k == 0) ? cells_.get() : levels_[k].data();
+  float best = kEmptyLikelihood;
+  for (int by = y0 >> k; by <= (y1 >> k); ++by) {
+    for (int bx = x0 >> k; bx <= (x1 >> k); ++bx) {
+      best = std::max(best, level[BlockIndex(k, bx << k, by << k)]);
+    }
+  }
+  return best;
+}
+
+void LikelihoodRaster::Recenter(const Vector2f& p) {
+  if (!cells_) return;
+  // Keep the window on whole tiles of the map grid, so that recentring by
+  // less than a tile is free.
+  const int min_x = FloorToTile(CellX(p.x()) - width_ / 2);
+  const int min_y = FloorToTile(CellY(p.y()) - height_ / 2);
+  const int dx = min_x - min_x_;
+  const int dy = min_y - min_y_;
+  if (dx == 0 && dy == 0) return;
+  if (abs(dx) >= width_ || abs(dy) >= height_) {
+    // Nothing stays in the window.
+    std::fill(cells_.get(), cells_.get() + width_ * height_, kEmptyLikelihood);
+    for (int k = 1; k <= kPyramidLevels; ++k) {
+      std::fill(levels_[k].begin(), levels_[k].end(), kEmptyLikelihood);
+    }
+    std::fill(tile_dirty_.begin(), tile_dirty_.end(), 0);
+    dirty_tiles_.clear();
+    min_x_ = min_x;
+    min_y_ = min_y;
+    offset_x_ = 0;
+    offset_y_ = 0;
+    return;
+  }
+  // Scroll in x: the storage columns of the cells that leave the window on
+  // one side hold the cells that enter it on the other.
+  if (dx > 0) {
+    ClearColumns(0, dx);
+  } else if (dx < 0) {
+    ClearColumns(width_ + dx, width_);
+  }
+  offset_x_ = ((offset_x_ + dx) % width_ + width_) % width_;
+  min_x_ = min_x;
+  // Then in y.
+  if (dy > 0) {
+    ClearRows(0, dy);
+  } else if (dy < 0) {
+    ClearRows(height_ + dy, height_);
+  }
+  offset_y_ = ((offset_y_ + dy) % height_ + height_) % height_;
+  min_y_ = min_y;
+}
+
+void LikelihoodRaster::Stamp(const Vector2f& p) {
+  const int x = CellX(p.x()) - min_x_;
+  const int y = CellY(p.y()) - min_y_;
+  const int x_min = std::max(x - kernel_radius_, 0);
+  const int y_min = std::max(y - kernel_radius_, 0);
+  const int x_max = std::min(x + kernel_radius_, width_ - 1);
+  const int y_max = std::min(y + kernel_radius_, height_ - 1);
+  if (x_min > x_max || y_min > y_max) return;
+  const int size = 2 * kernel_radius_ + 1;
+  // The stamped window columns are at most two runs of storage columns.
+  const int first = Column(x_min);
+  const int n = x_max - x_min + 1;
+  const int n1 = std::min(n, width_ - first);
+  for (int cy = y_min; cy <= y_max; ++cy) {
+    float* row = Row(cy);
+    const int storage_row = (row - cells_.get()) / width_;
+    if (cy == y_min || storage_row % kTileSize == 0) {
+      // First row of the stamp in this row of tiles.
+      const int tile_row = storage_row / kTileSize * tiles_x_;
+      MarkDirty(tile_row + first / kTileSize,
+                tile_row + (first + n1 - 1) / kTileSize);
+      if (n1 < n) MarkDirty(tile_row, tile_row + (n - n1 - 1) / kTileSize);
+    }
+    const float* k = kernel_.data() +
+        (cy - y + kernel_radius_) * size + (x_min - x + kernel_radius_);
+    float* __restrict__ a = row + first;
+    const float* __restrict__ ka = k;
+    #pragma omp simd
+    for (int i = 0; i < n1; ++i) {
+      a[i] = (ka[i] > a[i]) ? ka[i] : a[i];
+    }
+    float* __restrict__ b = row;
+    const float* __restrict__ kb = k + n1;
+    #pragma omp simd
+    for (int i = 0; i < n - n1; ++i) {
+      b[i] = (kb[i] > b[i]) ? kb[i] : b[i];
+    }
+  }
+
+}
+
+}  // namespace slam
@@ -0,0 +1,212 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    likelihood_raster.h
+\brief   Flat, robot-centred rolling raster of observation log likelihoods
+         for correlative scan matching, built by stamping a precomputed
+         kernel about every point.
+*/
+//========================================================================
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <memory>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#ifndef SRC_LIKELIHOOD_RASTER_H_
+#define SRC_LIKELIHOOD_RASTER_H_
+
+namespace slam {
+
+// Log likelihood of the cells no point has been stamped near.
+const float kEmptyLikelihood = -100000;
+
+// Side of the tiles that LikelihoodRaster clears, in cells: one cache line
+// of floats.
+const int kTileSize = 16;
+
+// Number of max-pooled levels that LikelihoodRaster keeps above its cells:
+// level k holds the largest log likelihood of every aligned block of 2^k x
+// 2^k cells, up to one tile.
+const int kPyramidLevels = 4;
+static_assert((1 << kPyramidLevels) == kTileSize,
+              "The top pyramid level must be one tile");
+
+// Window of observation log likelihoods over the map. Every cell holds the
+// best log likelihood over the points stamped into it, from a Gaussian kernel
+// about each point.
+//
+// The window is a fixed number of cells, anchored to the map grid: cell
+// (x, y) of the map covers [x, x + 1) * resolution by [y, y + 1) *
+// resolution. Recenter scrolls the window to follow the robot. The cells are
+// addressed toroidally, so scrolling only resets the strips of cells that
+// enter the window, and memory stays constant however large the mapped area.
+//
+// The cells are one contiguous, cache-line aligned array that is allocated
+// once. Clear only resets the tiles stamped since the last clear: a scan's
+// points lie along the walls, so they touch a small part of the raster, but
+// their bounding box covers nearly all of it.
+//
+// Max-pooled pyramid levels above the cells let MaxInRect bound the log
+// likelihood of a whole block of cells with a few lookups, e.g. for a branch
+// and bound search. UpdatePyramid pools the tiles stamped since its last
+// call, once per batch of stamps rather than on every stamp.
+class LikelihoodRaster {
+ public:
+  LikelihoodRaster();
+
+  // Cover the map cells of [min, max), rounded out to whole tiles, with cells
+  // of the given size, all empty, and precompute the stamp kernel: -d^2 /
+  // variance for the cells within kernel_radius cells in x and y of the
+  // stamped cell, d being the distance between the cell corners. Reallocates
+  // only if the window size changes.
+  void Init(const Eigen::Vector2f& min,
+            const Eigen::Vector2f& max,
+            float resolution,
+            int kernel_radius,
+            float variance);
+
+  // Reset every cell to kEmptyLikelihood.
+  void Clear();
+
+  // Scroll the window so that it is centred on the cell of p. Cells that
+  // stay in the window keep their values; the cells that enter it are empty.
+  void Recenter(const Eigen::Vector2f& p);
+
+  // Raise the cells about p to the kernel, where the kernel is higher. Cells
+  // outside the window are left out.
+  void Stamp(const Eigen::Vector2f& p);
+
+  // Bring the pyramid levels up to date with the cells stamped since the
+  // last update. Clear and Recenter keep them up to date themselves.
+  void UpdatePyramid();
+
+  // Map cell of a point.
+  int CellX(float x) const { return Floor(x / resolution_); }
+  int CellY(float y) const { return Floor(y / resolution_); }
+
+  // Log likelihood of map cell (x, y). Cells outside the window are empty.
+  float Get(int x, int y) const {
+    x -= min_x_;
+    y -= min_y_;
+    // Negative x and y wrap to large unsigned values.
+    if (static_cast<unsigned>(x) >= static_cast<unsigned>(width_) ||
+        static_cast<unsigned>(y) >= static_cast<unsigned>(height_)) {
+      return kEmptyLikelihood;
+    }
+    return Row(y)[Column(x)];
+  }
+
+  // Log likelihood of the cell of p.
+  float Get(const Eigen::Vector2f& p) const {
+    return Get(CellX(p.x()), CellY(p.y()));
+  }
+
+  // Largest log likelihood any cell can hold: the peak of the kernel.
+  float MaxLikelihood() const {
+    return kernel_.empty() ? kEmptyLikelihood :
+        kernel_[kernel_radius_ * (2 * kernel_radius_ + 1) + kernel_radius_];
+  }
+
+  // Largest log likelihood over map cells [x0, x1] x [y0, y1], as of the
+  // last UpdatePyramid. Cells outside the window are empty. Takes at most
+  // four lookups for rectangles up to a tile wide.
+  float MaxInRect(int x0, int y0, int x1, int y1) const;
+
+  float Resolution() const { return resolution_; }
+  // Window size, in cells.
+  int Width() const { return width_; }
+  int Height() const { return height_; }
+  // Map cell of the corner of the window.
+  int MinX() const { return min_x_; }
+  int MinY() const { return min_y_; }
+
+ private:
+  struct FreeDeleter {
+    void operator()(float* p) const { free(p); }
+  };
+
+  // Largest integer not above v, without a call to floor.
+  static int Floor(float v) {
+    const int i = static_cast<int>(v);
+    return i - (v < i);
+  }
+
+  // Storage column of window column x, and storage row of window row y:
+  // the window is rotated by (offset_x_, offset_y_) in storage.
+  int Column(int x) const {
+    x += offset_x_;
+    return (x >= width_) ? x - width_ : x;
+  }
+  int StorageRow(int y) const {
+    y += offset_y_;
+    return (y >= height_) ? y - height_ : y;
+  }
+  float* Row(int y) const { return cells_.get() + StorageRow(y) * width_; }
+
+  // Index into pyramid level k, with level 0 the cells, of the block that
+  // holds window cell (x, y).
+  int BlockIndex(int k, int x, int y) const {
+    return (StorageRow(y) >> k) * (width_ >> k) + (Column(x) >> k);
+  }
+
+  // Reset the pyramid blocks of the storage cells [x0, x1) x [y0, y1), which
+  // must be whole tiles.
+  void ClearBlocks(int x0, int y0, int x1, int y1);
+
+  // Flag storage tiles [first, last] of one row of tiles as stamped.
+  void MarkDirty(int first, int last);
+
+  // Reset window columns [begin, end) or rows [begin, end).
+  void ClearColumns(int begin, int end);
+  void ClearRows(int begin, int end);
+
+  // Size of a cell, in meters.
+  float resolution_;
+  // Window size, in cells: whole tiles, so that every row is cache-line
+  // aligned.
+  int width_;
+  int height_;
+  // Map cell of window cell (0, 0), and the storage cell that holds it.
+  int min_x_;
+  int min_y_;
+  int offset_x_;
+  int offset_y_;
+  // Row-major cells, in storage order.
+  std::unique_ptr<float, FreeDeleter> cells_;
+  // Pyramid levels 1 to kPyramidLevels, in the same storage order: level k
+  // is (width_ >> k) x (height_ >> k) blocks.
+  std::vector<float> levels_[kPyramidLevels + 1];
+
+  // Stamp kernel, (2 * kernel_radius_ + 1) cells square, row-major.
+  int kernel_radius_;
+  std::vector<float> kernel_;
+
+  // Storage tiles of kTileSize x kTileSize cells stamped since the last
+  // clear: a flag per tile, row-major, and the list of the flagged tiles.
+  int tiles_x_;
+  std::vector<uint8_t> tile_dirty_;
+  std::vector<int> dirty_tiles_;
+  // Storage tiles stamped since the last UpdatePyramid, likewise.
+  std::vector<uint8_t> tile_stale_;
+  std::vector<int> stale_tiles_;
+};
+
+}  // namespace slam
+
+#endif  // SRC_LIKELIHOOD_RASTER_H_
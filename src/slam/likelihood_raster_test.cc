@@ -0,0 +1,173 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    likelihood_raster_test.cc
+\brief   Checks the scrolling LikelihoodRaster against a map of the stamped
+         cells, over scrolls by parts of, whole, and more than a window in
+         each direction.
+*/
+//========================================================================
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "slam/likelihood_raster.h"
+
+using Eigen::Vector2f;
+using slam::LikelihoodRaster;
+using std::vector;
+
+namespace {
+
+const float kResolution = 0.05;
+const int kKernelRadius = 3;
+const float kVariance = 0.01;
+
+// Log likelihood of every stamped cell still in the window, by map cell.
+typedef std::map<std::pair<int, int>, float> CellMap;
+
+bool InWindow(const LikelihoodRaster& raster, int x, int y) {
+  return x >= raster.MinX() && x < raster.MinX() + raster.Width() &&
+      y >= raster.MinY() && y < raster.MinY() + raster.Height();
+}
+
+// Stamp p into the raster and the reference, as LikelihoodRaster::Stamp does.
+void Stamp(const Vector2f& p, LikelihoodRaster* raster, CellMap* reference) {
+  raster->Stamp(p);
+  const int cx = raster->CellX(p.x());
+  const int cy = raster->CellY(p.y());
+  for (int dy = -kKernelRadius; dy <= kKernelRadius; ++dy) {
+    for (int dx = -kKernelRadius; dx <= kKernelRadius; ++dx) {
+      if (!InWindow(*raster, cx + dx, cy + dy)) continue;
+      const float ex = dx * kResolution;
+      const float ey = dy * kResolution;
+      const float v = -(pow(ex, 2) + pow(ey, 2)) / kVariance;
+      const std::pair<int, int> cell(cx + dx, cy + dy);
+      const CellMap::iterator it = reference->find(cell);
+      if (it == reference->end()) {
+        (*reference)[cell] = v;
+      } else {
+        it->second = std::max(it->second, v);
+      }
+    }
+  }
+}
+
+// Compare every cell of the window and a margin about it with the reference,
+// and MaxInRect with the largest cell of random rectangles. Returns the number
+// of mismatches.
+int Check(const LikelihoodRaster& raster,
+          const CellMap& reference,
+          std::mt19937* gen) {
+  int errors = 0;
+  for (int y = raster.MinY() - 2; y < raster.MinY() + raster.Height() + 2;
+       ++y) {
+    for (int x = raster.MinX() - 2; x < raster.MinX() + raster.Width() + 2;
+         ++x) {
+      const CellMap::const_iterator it =
+          reference.find(std::make_pair(x, y));
+      const float expected =
+          (it == reference.end()) ? slam::kEmptyLikelihood : it->second;
+      if (raster.Get(x, y) != expected) ++errors;
+    }
+  }
+  std::uniform_int_distribution<int> corner(-5, raster.Width() + 5);
+  std::uniform_int_distribution<int> span(0, 3 * slam::kTileSize);
+  for (int i = 0; i < 500; ++i) {
+    const int x0 = raster.MinX() + corner(*gen);
+    const int y0 = raster.MinY() + corner(*gen);
+    const int x1 = x0 + span(*gen);
+    const int y1 = y0 + span(*gen);
+    float max_cell = slam::kEmptyLikelihood;
+    for (int y = y0; y <= y1; ++y) {
+      for (int x = x0; x <= x1; ++x) {
+        max_cell = std::max(max_cell, raster.Get(x, y));
+      }
+    }
+    if (raster.MaxInRect(x0, y0, x1, y1) < max_cell) ++errors;
+    if (raster.MaxInRect(x0, y0, x0, y0) != raster.Get(x0, y0)) ++errors;
+  }
+  return errors;
+}
+
+}  // namespace
+
+int main() {
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> offset(-1, 1);
+  LikelihoodRaster raster;
+  raster.Init(Vector2f(-3, -3), Vector2f(3, 3), kResolution, kKernelRadius,
+              kVariance);
+  const int tiles_x = raster.Width() / slam::kTileSize;
+  const int tiles_y = raster.Height() / slam::kTileSize;
+  // Scrolls of the robot, in tiles: less than a tile, by one tile, by part
+  // of the window, by all but one tile, by exactly the window, and by more,
+  // each way along each axis and diagonally.
+  const float kSubTile = 0.3;
+  const vector<Vector2f> scrolls = {
+    {kSubTile, 0}, {0, -kSubTile},
+    {1, 0}, {-1, 0}, {0, 1}, {0, -1},
+    {3, -2}, {-3, 2}, {tiles_x / 2.0f, tiles_y / 3.0f},
+    {tiles_x - 1.0f, 0}, {0, 1.0f - tiles_y},
+    {-(tiles_x - 1.0f), tiles_y - 1.0f},
+    {tiles_x, 0}, {0, -tiles_y},
+    {tiles_x + 2.0f, -(tiles_y + 1.0f)}, {-2.5f * tiles_x, 0},
+  };
+  CellMap reference;
+  Vector2f robot(0, 0);
+  int errors = 0;
+  int checks = 0;
+  // Several rounds, so that the storage offsets wrap in both directions.
+  for (int round = 0; round < 4; ++round) {
+    for (const Vector2f& scroll : scrolls) {
+      const float sign = (round % 2 == 0) ? 1 : -1;
+      robot += sign * slam::kTileSize * kResolution * scroll;
+      raster.Recenter(robot);
+      for (CellMap::iterator it = reference.begin(); it != reference.end();) {
+        if (InWindow(raster, it->first.first, it->first.second)) {
+          ++it;
+        } else {
+          it = reference.erase(it);
+        }
+      }
+      // Points about the robot, some of them out of the window.
+      for (int i = 0; i < 60; ++i) {
+        Stamp(robot + 4 * Vector2f(offset(gen), offset(gen)), &raster,
+              &reference);
+      }
+      raster.UpdatePyramid();
+      const int scroll_errors = Check(raster, reference, &gen);
+      if (scroll_errors > 0) {
+        printf("round %d, scroll (%g, %g) tiles: %d mismatches\n", round,
+               sign * scroll.x(), sign * scroll.y(), scroll_errors);
+      }
+      errors += scroll_errors;
+      ++checks;
+    }
+    raster.Clear();
+    reference.clear();
+    errors += Check(raster, reference, &gen);
+  }
+  printf("%d scrolls checked: %s\n", checks, (errors == 0) ? "PASS" : "FAIL");
+  return (errors == 0) ? 0 : 1;
+}
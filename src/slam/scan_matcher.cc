@@ -0,0 +1,393 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    scan_matcher.cc
+\brief   Correlative scan matching of a scan against a likelihood raster,
+         over a lattice of candidate poses.
+*/
+//========================================================================
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "eigen3/Eigen/Geometry"
+
+#include "scan_matcher.h"
+
+using Eigen::Rotation2Df;
+using Eigen::Vector2f;
+using std::vector;
+
+namespace {
+
+// Largest block of translations that BranchAndBound scores without
+// bounding it further: scoring a few candidates costs less than bounding
+// their halves.
+const int kMaxLeafSize = 6;
+
+// Widest box of cells, per point, that BranchAndBound looks up in the
+// pyramid. The boxes of larger blocks cover walls for nearly every point, so
+// they are bounded by the peak log likelihood instead, at no cost.
+const int kMaxBoundedSpan = 2 * slam::kTileSize;
+
+// Offsets of n lattice points evenly spaced over +-window standard
+// deviations, and their log likelihoods -(offset / stddev)^2.
+void SetOffsets(float stddev,
+                int n,
+                float window,
+                vector<float>* offsets,
+                vector<float>* log_likelihoods) {
+  offsets->resize(n);
+  log_likelihoods->resize(n);
+  for (int i = 0; i < n; ++i) {
+    const float t = (n > 1) ? window * (2.0f * i / (n - 1) - 1) : 0;
+    (*offsets)[i] = stddev * t;
+    (*log_likelihoods)[i] = -(t * t);
+  }
+}
+
+// Whether the candidate at index, with score, beats the best candidate so far:
+// a higher score, or an equal one at a lower index. An index of -1 is no
+// candidate. The order is total, so the best of any split of the candidates
+// is the same candidate.
+bool Better(float score, int index, float best_score, int best_index) {
+  return index >= 0 && (best_index < 0 || score > best_score ||
+                        (score == best_score && index < best_index));
+}
+
+}  // namespace
+
+namespace slam {
+
+CandidateLattice::CandidateLattice() {}
+
+void CandidateLattice::Init(const Vector2f& loc,
+                            float angle,
+                            float x_stddev,
+                            float y_stddev,
+                            float angle_stddev,
+                            int num_x,
+                            int num_y,
+                            int num_angles,
+                            float window,
+                            float resolution) {
+  SetOffsets(x_stddev, num_x, window, &x_offsets_, &x_log_likelihoods_);
+  SetOffsets(y_stddev, num_y, window, &y_offsets_, &y_log_likelihoods_);
+  SetOffsets(angle_stddev, num_angles, window, &angles_,
+             &angle_log_likelihoods_);
+  for (float& a : angles_) a += angle;
+  const float c = cos(angle);
+  const float s = sin(angle);
+  origin_ = loc;
+  shift_x_.resize(num_x * num_y);
+  shift_y_.resize(num_x * num_y);
+  locations_.resize(num_x * num_y);
+  for (int ix = 0; ix < num_x; ++ix) {
+    for (int iy = 0; iy < num_y; ++iy) {
+      const float dx = x_offsets_[ix];
+      const float dy = y_offsets_[iy];
+      const int t = Translation(ix, iy);
+      shift_x_[t] = lrint((dx * c - dy * s) / resolution);
+      shift_y_[t] = lrint((dx * s + dy * c) / resolution);
+      locations_[t] = loc + resolution * Vector2f(shift_x_[t], shift_y_[t]);
+    }
+  }
+}
+
+Pose CandidateLattice::Get(int index) const {
+  const int ia = index % NumAngles();
+  const int iy = index / NumAngles() % NumY();
+  const int ix = index / NumAngles() / NumY();
+  Pose pose;
+  pose.loc = Location(ix, iy);
+  pose.angle = Angle(ia);
+  pose.log_likelihood = LogLikelihood(ix, iy, ia);
+  return pose;
+}
+
+float CandidateLattice::MaxLogLikelihood(int x0,
+                                         int x1,
+                                         int y0,
+                                         int y1,
+                                         int ia) const {
+  return *std::max_element(x_log_likelihoods_.begin() + x0,
+                           x_log_likelihoods_.begin() + x1 + 1) +
+      *std::max_element(y_log_likelihoods_.begin() + y0,
+                        y_log_likelihoods_.begin() + y1 + 1) +
+      AngleLogLikelihood(ia);
+}
+
+void ScanMatcher::PlacePoints(const LikelihoodRaster& table,
+                              const vector<Vector2f>& points,
+                              const CandidateLattice& candidates,
+                              int ia) {
+  const Vector2f& origin = candidates.Origin();
+  const Eigen::Matrix2f rotation =
+      Rotation2Df(candidates.Angle(ia)).toRotationMatrix();
+  int* cell_x = cell_x_.data() + ia * num_points_;
+  int* cell_y = cell_y_.data() + ia * num_points_;
+  for (int p = 0; p < num_points_; ++p) {
+    const Vector2f point = origin + rotation * points[p];
+    cell_x[p] = table.CellX(point.x());
+    cell_y[p] = table.CellY(point.y());
+  }
+}
+
+float ScanMatcher::Score(const LikelihoodRaster& table,
+                         const CandidateLattice& candidates,
+                         float obs_weight,
+                         float motion_weight,
+                         int ix,
+                         int iy,
+                         int ia) const {
+  const int t = candidates.Translation(ix, iy);
+  const int shift_x = candidates.ShiftX(t);
+  const int shift_y = candidates.ShiftY(t);
+  const int* cell_x = cell_x_.data() + ia * num_points_;
+  const int* cell_y = cell_y_.data() + ia * num_points_;
+  float obs_log_likelihood = 0;
+  for (int p = 0; p < num_points_; ++p) {
+    obs_log_likelihood += table.Get(cell_x[p] + shift_x, cell_y[p] + shift_y);
+  }
+  return obs_weight * obs_log_likelihood +
+      motion_weight * candidates.LogLikelihood(ix, iy, ia);
+}
+
+float ScanMatcher::Bound(const LikelihoodRaster& table,
+                         const CandidateLattice& candidates,
+                         float obs_weight,
+                         float motion_weight,
+                         const Node& node) const {
+  // Every shift of the node lies in the bounding box of its corners, so the
+  // box shifted by the cell of a point holds the cell of the point at every
+  // candidate.
+  int lo_x = std::numeric_limits<int>::max();
+  int lo_y = std::numeric_limits<int>::max();
+  int hi_x = std::numeric_limits<int>::min();
+  int hi_y = std::numeric_limits<int>::min();
+  for (const int ix : {node.x0, node.x1}) {
+    for (const int iy : {node.y0, node.y1}) {
+      const int t = candidates.Translation(ix, iy);
+      lo_x = std::min(lo_x, candidates.ShiftX(t));
+      lo_y = std::min(lo_y, candidates.ShiftY(t));
+      hi_x = std::max(hi_x, candidates.ShiftX(t));
+      hi_y = std::max(hi_y, candidates.ShiftY(t));
+    }
+  }
+  const int* cell_x = cell_x_.data() + node.angle * num_points_;
+  const int* cell_y = cell_y_.data() + node.angle * num_points_;
+  float obs_log_likelihood = 0;
+  if (std::max(hi_x - lo_x, hi_y - lo_y) >= kMaxBoundedSpan) {
+    for (int p = 0; p < num_points_; ++p) {
+      obs_log_likelihood += table.MaxLikelihood();
+    }
+  } else {
+    for (int p = 0; p < num_points_; ++p) {
+      obs_log_likelihood += table.MaxInRect(cell_x[p] + lo_x,
+                                            cell_y[p] + lo_y,
+                                            cell_x[p] + hi_x,
+                                            cell_y[p] + hi_y);
+    }
+  }
+  // Sums of larger terms are never smaller in floating point, so this bounds
+  // the score of every candidate as Score computes it.
+  return obs_weight * obs_log_likelihood + motion_weight *
+      candidates.MaxLogLikelihood(node.x0, node.x1, node.y0, node.y1,
+                                  node.angle);
+}
+
+int ScanMatcher::Exhaustive(const LikelihoodRaster& table,
+                            const vector<Vector2f>& points,
+                            const CandidateLattice& candidates,
+                            float obs_weight,
+                            float motion_weight,
+                            int num_threads) {
+  num_scored_ = candidates.size();
+  num_points_ = points.size();
+  cell_x_.resize(num_points_ * candidates.NumAngles());
+  cell_y_.resize(num_points_ * candidates.NumAngles());
+  const int num_translations = candidates.NumTranslations();
+  float best_score = -std::numeric_limits<float>::max();
+  int best_index = -1;
+  std::mutex result_mutex;
+
+  #pragma omp parallel num_threads(num_threads)
+  {
+    // Summed raster log likelihoods of the translations of one rotation.
+    vector<float> sums(num_translations);
+    float* __restrict__ obs_log_likelihoods = sums.data();
+    float thread_best_score = -std::numeric_limits<float>::max();
+    int thread_best_index = -1;
+
+    #pragma omp for schedule(dynamic, 1)
+    for (int ia = 0; ia < candidates.NumAngles(); ++ia) {
+      PlacePoints(table, points, candidates, ia);
+      // All the translations of the rotation, point by point: the same sums,
+      // in the same order, as Score.
+      std::fill(obs_log_likelihoods, obs_log_likelihoods + num_translations,
+                0);
+      const int* cell_x = cell_x_.data() + ia * num_points_;
+      const int* cell_y = cell_y_.data() + ia * num_points_;
+      for (int p = 0; p < num_points_; ++p) {
+        for (int t = 0; t < num_translations; ++t) {
+          obs_log_likelihoods[t] +=
+              table.Get(cell_x[p] + candidates.ShiftX(t),
+                        cell_y[p] + candidates.ShiftY(t));
+        }
+      }
+      for (int ix = 0; ix < candidates.NumX(); ++ix) {
+        for (int iy = 0; iy < candidates.NumY(); ++iy) {
+          const float score = obs_weight *
+              obs_log_likelihoods[candidates.Translation(ix, iy)] +
+              motion_weight * candidates.LogLikelihood(ix, iy, ia);
+          const int index = candidates.Index(ix, iy, ia);
+          if (Better(score, index, thread_best_score, thread_best_index)) {
+            thread_best_score = score;
+            thread_best_index = index;
+          }
+        }
+      }
+    }
+
+    // The best of each thread's rotations, in any order: the tie rule makes
+    // the result independent of how the rotations were shared out.
+    std::lock_guard<std::mutex> lock(result_mutex);
+    if (Better(thread_best_score, thread_best_index, best_score, best_index)) {
+      best_score = thread_best_score;
+      best_index = thread_best_index;
+    }
+  }
+  return best_index;
+}
+
+int ScanMatcher::BranchAndBound(const LikelihoodRaster& table,
+                                const vector<Vector2f>& points,
+                                const CandidateLattice& candidates,
+                                float obs_weight,
+                                float motion_weight,
+                                int num_threads) {
+  num_scored_ = 0;
+  if (candidates.empty()) return -1;
+  num_points_ = points.size();
+  cell_x_.resize(num_points_ * candidates.NumAngles());
+  cell_y_.resize(num_points_ * candidates.NumAngles());
+  // Whether node a should be searched before node b: higher bound first, and
+  // on equal bounds, the node holding the lower candidate index.
+  const auto first = [&candidates](const Node& a, const Node& b) {
+    if (a.bound != b.bound) return a.bound > b.bound;
+    return candidates.Index(a.x0, a.y0, a.angle) <
+        candidates.Index(b.x0, b.y0, b.angle);
+  };
+
+  // One root per rotation.
+  vector<Node> roots(candidates.NumAngles());
+  // Best score found by any thread so far. No node bounded below it can hold
+  // the best candidate, whichever thread searches it.
+  std::atomic<float> threshold(-std::numeric_limits<float>::max());
+  float best_score = -std::numeric_limits<float>::max();
+  int best_index = -1;
+  std::mutex result_mutex;
+
+  #pragma omp parallel num_threads(num_threads)
+  {
+    #pragma omp for schedule(dynamic, 1)
+    for (int ia = 0; ia < candidates.NumAngles(); ++ia) {
+      PlacePoints(table, points, candidates, ia);
+      Node& root = roots[ia];
+      root = {ia, 0, candidates.NumX() - 1, 0, candidates.NumY() - 1, 0};
+      root.bound = Bound(table, candidates, obs_weight, motion_weight, root);
+    }
+
+    // The most promising rotations are handed out first.
+    #pragma omp single
+    std::sort(roots.begin(), roots.end(), first);
+
+    // Depth-first stack of nodes still to search.
+    vector<Node> stack;
+    float thread_best_score = -std::numeric_limits<float>::max();
+    int thread_best_index = -1;
+    int num_scored = 0;
+
+    #pragma omp for schedule(dynamic, 1)
+    for (size_t r = 0; r < roots.size(); ++r) {
+      stack.assign(1, roots[r]);
+      while (!stack.empty()) {
+        const Node node = stack.back();
+        stack.pop_back();
+        // Prune the nodes that cannot hold a better candidate, or an equal
+        // one of lower index than the thread has found.
+        if (node.bound < threshold ||
+            (thread_best_index >= 0 && node.bound == thread_best_score &&
+             candidates.Index(node.x0, node.y0, node.angle) >
+                 thread_best_index)) {
+          continue;
+        }
+        const int size = (node.x1 - node.x0 + 1) * (node.y1 - node.y0 + 1);
+        if (size <= kMaxLeafSize) {
+          for (int ix = node.x0; ix <= node.x1; ++ix) {
+            for (int iy = node.y0; iy <= node.y1; ++iy) {
+              const float score = Score(table, candidates, obs_weight,
+                                        motion_weight, ix, iy, node.angle);
+              const int index = candidates.Index(ix, iy, node.angle);
+              if (Better(score, index, thread_best_score, thread_best_index)) {
+                thread_best_score = score;
+                thread_best_index = index;
+              }
+            }
+          }
+          num_scored += size;
+          float t = threshold;
+          while (thread_best_score > t &&
+                 !threshold.compare_exchange_weak(t, thread_best_score)) {}
+          continue;
+        }
+        // Split the longer side in two.
+        Node low = node;
+        Node high = node;
+        if (node.x1 - node.x0 >= node.y1 - node.y0) {
+          low.x1 = (node.x0 + node.x1) / 2;
+          high.x0 = low.x1 + 1;
+        } else {
+          low.y1 = (node.y0 + node.y1) / 2;
+          high.y0 = low.y1 + 1;
+        }
+        low.bound = Bound(table, candidates, obs_weight, motion_weight, low);
+        high.bound = Bound(table, candidates, obs_weight, motion_weight, high);
+        if (first(low, high)) {
+          stack.push_back(high);
+          stack.push_back(low);
+        } else {
+          stack.push_back(low);
+          stack.push_back(high);
+        }
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(result_mutex);
+    num_scored_ += num_scored;
+    if (Better(thread_best_score, thread_best_index, best_score, best_index)) {
+      best_score = thread_best_score;
+      best_index = thread_best_index;
+    }
+  }
+  return best_index;
+}
+
+}  // namespace slam
@@ -0,0 +1,203 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    scan_matcher.h
+\brief   Correlative scan matching of a scan against a likelihood raster,
+         over a lattice of candidate poses.
+*/
+//========================================================================
+
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "slam/likelihood_raster.h"
+
+#ifndef SRC_SCAN_MATCHER_H_
+#define SRC_SCAN_MATCHER_H_
+
+namespace slam {
+
+struct Pose {
+  Eigen::Vector2f loc;
+  float angle;
+  float log_likelihood = 0.0;
+};
+
+// Candidate poses about a predicted pose: num_x by num_y translations along
+// the axes of the pose, by num_angles rotations. The offsets along each axis
+// are evenly spaced over +-window standard deviations of the motion model,
+// and every candidate has the motion model log likelihood of its offsets.
+//
+// The translations are snapped to the grid of the likelihood raster, so that
+// each moves the scan by a whole number of cells from the predicted pose.
+//
+// Candidate (ix, iy, ia) has index (ix * num_y + iy) * num_angles + ia, and
+// translation ix * num_y + iy.
+class CandidateLattice {
+ public:
+  CandidateLattice();
+
+  void Init(const Eigen::Vector2f& loc,
+            float angle,
+            float x_stddev,
+            float y_stddev,
+            float angle_stddev,
+            int num_x,
+            int num_y,
+            int num_angles,
+            float window,
+            float resolution);
+
+  int NumX() const { return x_offsets_.size(); }
+  int NumY() const { return y_offsets_.size(); }
+  int NumAngles() const { return angles_.size(); }
+  int NumTranslations() const { return NumX() * NumY(); }
+  int size() const { return NumTranslations() * NumAngles(); }
+  bool empty() const { return size() == 0; }
+
+  int Translation(int ix, int iy) const { return ix * NumY() + iy; }
+  int Index(int ix, int iy, int ia) const {
+    return Translation(ix, iy) * NumAngles() + ia;
+  }
+
+  // Predicted location the translations are relative to.
+  const Eigen::Vector2f& Origin() const { return origin_; }
+  // Map frame location of translation (ix, iy).
+  const Eigen::Vector2f& Location(int ix, int iy) const {
+    return locations_[Translation(ix, iy)];
+  }
+  // Translation t from the origin, in cells. It is monotonic in each of ix
+  // and iy, so the shifts of a block of translations lie within the bounding
+  // box of its four corners.
+  int ShiftX(int t) const { return shift_x_[t]; }
+  int ShiftY(int t) const { return shift_y_[t]; }
+  float Angle(int ia) const { return angles_[ia]; }
+
+  // Motion model log likelihood of each offset. A candidate's log likelihood
+  // is the sum of those of its three offsets.
+  float XLogLikelihood(int ix) const { return x_log_likelihoods_[ix]; }
+  float YLogLikelihood(int iy) const { return y_log_likelihoods_[iy]; }
+  float AngleLogLikelihood(int ia) const { return angle_log_likelihoods_[ia]; }
+  float LogLikelihood(int ix, int iy, int ia) const {
+    return XLogLikelihood(ix) + YLogLikelihood(iy) + AngleLogLikelihood(ia);
+  }
+  // Largest log likelihood of the candidates [x0, x1] x [y0, y1] at rotation
+  // ia, summed in the same order as LogLikelihood.
+  float MaxLogLikelihood(int x0, int x1, int y0, int y1, int ia) const;
+
+  Pose Get(int index) const;
+
+ private:
+  std::vector<float> x_offsets_;
+  std::vector<float> y_offsets_;
+  std::vector<float> x_log_likelihoods_;
+  std::vector<float> y_log_likelihoods_;
+  std::vector<float> angles_;
+  std::vector<float> angle_log_likelihoods_;
+  Eigen::Vector2f origin_;
+  std::vector<int> shift_x_;
+  std::vector<int> shift_y_;
+  std::vector<Eigen::Vector2f> locations_;
+};
+
+// Finds the candidate pose that best aligns a scan with a likelihood raster.
+// A candidate scores obs_weight times the summed raster log likelihoods of the
+// scan points placed at the candidate pose, plus motion_weight times its
+// motion model log likelihood. Ties go to the lowest candidate index. The
+// weights must not be negative.
+//
+// The scan is rotated once per angle of the lattice, and its points placed in
+// the cells of the raster about the lattice origin. Every translation then
+// only shifts those cells by whole cells, so a candidate costs one integer
+// add and one raster read per point. Exhaustive scores all the translations
+// of a rotation point by point, reading the neighbouring cells of each point
+// in turn.
+//
+// BranchAndBound returns the same candidate as Exhaustive. It bounds the
+// score of a block of translations from the max-pooled levels of the raster,
+// and only scores the candidates of the blocks whose bound can still beat the
+// best score found, so its cost grows with how ambiguous the match is rather
+// than with the size of the lattice.
+//
+// Both share the rotations of the lattice out among num_threads threads, and
+// each thread keeps its own best candidate. BranchAndBound threads also prune
+// against the best score found by any thread. The tie rule orders all the
+// candidates, so the result does not depend on the number of threads.
+class ScanMatcher {
+ public:
+  // Index of the best candidate, with points in the robot frame.
+  int Exhaustive(const LikelihoodRaster& table,
+                 const std::vector<Eigen::Vector2f>& points,
+                 const CandidateLattice& candidates,
+                 float obs_weight,
+                 float motion_weight,
+                 int num_threads);
+  int BranchAndBound(const LikelihoodRaster& table,
+                     const std::vector<Eigen::Vector2f>& points,
+                     const CandidateLattice& candidates,
+                     float obs_weight,
+                     float motion_weight,
+                     int num_threads);
+
+  // Number of candidates fully scored by the last match.
+  int NumScored() const { return num_scored_; }
+
+ private:
+  // Block of translations [x0, x1] x [y0, y1] at one rotation of the
+  // lattice, with an upper bound on the scores of its candidates.
+  struct Node {
+    int angle;
+    int x0;
+    int x1;
+    int y0;
+    int y1;
+    float bound;
+  };
+
+  // Rotate the points by angle ia of the lattice, and place them at the
+  // lattice origin into row ia of cell_x_ and cell_y_.
+  void PlacePoints(const LikelihoodRaster& table,
+                   const std::vector<Eigen::Vector2f>& points,
+                   const CandidateLattice& candidates,
+                   int ia);
+
+  // Score of candidate (ix, iy, ia), from the placed points.
+  float Score(const LikelihoodRaster& table,
+              const CandidateLattice& candidates,
+              float obs_weight,
+              float motion_weight,
+              int ix,
+              int iy,
+              int ia) const;
+
+  // Upper bound on the scores of the candidates of node, from the placed
+  // points.
+  float Bound(const LikelihoodRaster& table,
+              const CandidateLattice& candidates,
+              float obs_weight,
+              float motion_weight,
+              const Node& node) const;
+
+  // Raster cells of the scan points at the lattice origin, rotated by each
+  // angle of the lattice: one row of num_points_ per angle.
+  std::vector<int> cell_x_;
+  std::vector<int> cell_y_;
+  int num_points_ = 0;
+  int num_scored_ = 0;
+};
+
+}  // namespace slam
+
+#endif  // SRC_SCAN_MATCHER_H_
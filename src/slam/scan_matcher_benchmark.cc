@@ -0,0 +1,226 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    scan_matcher_benchmark.cc
+\brief   Micro-benchmark of the SLAM correlative scan matcher, comparing the
+         exhaustive and the branch and bound search over candidate lattices
+         of growing size, on one thread and on all of them.
+*/
+//========================================================================
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "eigen3/Eigen/Dense"
+#include "eigen3/Eigen/Geometry"
+
+#include "shared/math/line2d.h"
+#include "shared/util/timer.h"
+#include "scan_geometry/beam_directions.h"
+#include "slam/likelihood_raster.h"
+#include "slam/scan_matcher.h"
+
+using Eigen::Rotation2Df;
+using Eigen::Vector2f;
+using geometry::line2f;
+using scan_geometry::BeamDirections;
+using slam::CandidateLattice;
+using slam::LikelihoodRaster;
+using slam::ScanMatcher;
+using std::vector;
+
+namespace {
+
+// Scan geometry of a 270 degree, quarter degree laser.
+const int kNumBeams = 1081;
+const float kAngleMin = -0.75 * M_PI;
+const float kAngleMax = 0.75 * M_PI;
+const float kRangeMax = 10.0;
+// SLAM scores every kSkip-th beam, up to kMaxScoredRange.
+const int kSkip = 10;
+const float kMaxScoredRange = 9;
+// The SLAM likelihood table parameters.
+const float kTableResolution = 0.01;
+const int kKernelRadius = 10;
+const float kObsVariance = 0.01;
+const float kObsWeight = 3.0 / 1000;
+const float kMotionWeight = 1.0 / 3;
+// Motion model standard deviations for a 10 cm step.
+const float kTranslationStddev = 0.08;
+const float kRotationStddev = 0.05;
+
+// Beam endpoints of a scan from the laser at loc, heading angle, in the laser
+// frame.
+vector<float> CastScan(const vector<line2f>& lines,
+                       const BeamDirections& directions,
+                       const Vector2f& loc,
+                       float angle) {
+  vector<float> ranges(kNumBeams, kRangeMax);
+  const Eigen::Matrix2f rotation = Rotation2Df(angle).toRotationMatrix();
+  for (int i = 0; i < kNumBeams; ++i) {
+    const line2f ray(loc,
+                     loc + kRangeMax * (rotation * directions.Direction(i)));
+    for (const line2f& l : lines) {
+      Vector2f p;
+      if (ray.Intersection(l, &p)) {
+        ranges[i] = std::min(ranges[i], (p - loc).norm());
+      }
+    }
+  }
+  return ranges;
+}
+
+struct Lattice {
+  int num_x;
+  int num_y;
+  int num_angles;
+  float window;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> xy_dist(-1, 1);
+  std::uniform_real_distribution<float> angle_dist(-M_PI, M_PI);
+
+  // A 14 m square room with random interior walls.
+  vector<line2f> lines;
+  lines.push_back(line2f(-7, -7, 7, -7));
+  lines.push_back(line2f(7, -7, 7, 7));
+  lines.push_back(line2f(7, 7, -7, 7));
+  lines.push_back(line2f(-7, 7, -7, -7));
+  for (int i = 0; i < 30; ++i) {
+    const Vector2f p(6 * xy_dist(gen), 6 * xy_dist(gen));
+    const float a = angle_dist(gen);
+    lines.push_back(line2f(p, p + Vector2f(cos(a), sin(a))));
+  }
+  const BeamDirections& directions = *scan_geometry::GetBeamDirections(
+      kAngleMin, kAngleMax, kNumBeams);
+  const Vector2f laser_offset(0.2, 0);
+
+  // The table holds the last few scans, stamped at their true poses, as
+  // SLAM::ObserveLaser stamps them.
+  LikelihoodRaster table;
+  table.Init(Vector2f(-8, -8), Vector2f(8, 8), kTableResolution,
+             kKernelRadius, kObsVariance);
+  table.Recenter(Vector2f(0, 0));
+  for (int k = 0; k < 5; ++k) {
+    const Vector2f loc(-0.1 * k, 0.02 * k);
+    const float angle = -0.01 * k;
+    const Eigen::Matrix2f rotation = Rotation2Df(angle).toRotationMatrix();
+    const vector<float> ranges =
+        CastScan(lines, directions, loc + rotation * laser_offset, angle);
+    for (int i = 0; i < kNumBeams; ++i) {
+      table.Stamp(loc + rotation *
+                  (ranges[i] * directions.Direction(i) + laser_offset));
+    }
+  }
+  table.UpdatePyramid();
+
+  // The new scan, taken 10 cm on, and matched about a pose predicted with
+  // odometry error.
+  const Vector2f true_loc(0.1, 0.01);
+  const float true_angle = 0.02;
+  const Vector2f predicted_loc = true_loc + Vector2f(0.05, -0.04);
+  const float predicted_angle = true_angle - 0.03;
+  const vector<float> ranges = CastScan(
+      lines, directions,
+      true_loc + Rotation2Df(true_angle) * laser_offset, true_angle);
+  vector<Vector2f> points;
+  for (int j = 0; j < kNumBeams; j += kSkip) {
+    if (ranges[j] > kMaxScoredRange) continue;
+    points.push_back(ranges[j] * directions.Direction(j) + laser_offset);
+  }
+
+  // The lattice SLAM searches, lattices 3x and 10x wider at the same
+  // spacing, and the SLAM lattice at a 10x finer angular resolution.
+  const Lattice lattices[] = {
+    {3, 3, 3, 1},
+    {7, 7, 7, 3},
+    {31, 31, 31, 10},
+    {3, 3, 21, 1},
+  };
+#ifdef _OPENMP
+  const int num_threads = omp_get_max_threads();
+#else
+  const int num_threads = 1;
+#endif
+  printf("Points: %d, table resolution: %g m, threads: %d\n",
+         static_cast<int>(points.size()), kTableResolution, num_threads);
+  printf("%-16s %10s %12s %12s %12s %12s %12s %10s %9s %s\n", "Lattice",
+         "candidates", "per pose", "exhaustive", "parallel", "b&b",
+         "parallel", "scored", "error", "same");
+  ScanMatcher matcher;
+  CandidateLattice candidates;
+  for (const Lattice& l : lattices) {
+    candidates.Init(predicted_loc, predicted_angle, kTranslationStddev,
+                    kTranslationStddev, kRotationStddev, l.num_x, l.num_y,
+                    l.num_angles, l.window, kTableResolution);
+    const int repeats = std::max(1, 200000 / candidates.size());
+    // The candidate-major loop: every point transformed and looked up at
+    // every candidate pose.
+    double checksum = 0;
+    double t_start = GetMonotonicTime();
+    for (int k = 0; k < repeats; ++k) {
+      for (int i = 0; i < candidates.size(); ++i) {
+        const slam::Pose pose = candidates.Get(i);
+        const Eigen::Matrix2f rotation =
+            Rotation2Df(pose.angle).toRotationMatrix();
+        float obs_log_likelihood = 0;
+        for (const Vector2f& point : points) {
+          obs_log_likelihood += table.Get(pose.loc + rotation * point);
+        }
+        checksum += obs_log_likelihood;
+      }
+    }
+    const double t_reference = (GetMonotonicTime() - t_start) / repeats;
+    // Each search, on one thread and on num_threads.
+    int results[4];
+    double times[4];
+    for (int k = 0; k < 4; ++k) {
+      const int threads = (k % 2 == 0) ? 1 : num_threads;
+      t_start = GetMonotonicTime();
+      for (int r = 0; r < repeats; ++r) {
+        results[k] = (k < 2) ?
+            matcher.Exhaustive(table, points, candidates, kObsWeight,
+                               kMotionWeight, threads) :
+            matcher.BranchAndBound(table, points, candidates, kObsWeight,
+                                   kMotionWeight, threads);
+      }
+      times[k] = (GetMonotonicTime() - t_start) / repeats;
+    }
+    const bool same = std::count(results, results + 4, results[0]) == 4;
+    const slam::Pose best = candidates.Get(results[3]);
+    char name[32];
+    snprintf(name, sizeof(name), "%dx%dx%d +-%g", l.num_x, l.num_y,
+             l.num_angles, l.window);
+    printf("%-16s %10d %9.1f us %9.1f us %9.1f us %9.1f us %9.1f us %10d "
+           "%6.1f cm %s\n",
+           name, candidates.size(), 1e6 * t_reference, 1e6 * times[0],
+           1e6 * times[1], 1e6 * times[2], 1e6 * times[3],
+           matcher.NumScored(), 100 * (best.loc - true_loc).norm(),
+           same ? "yes" : "NO");
+    if (checksum == 0) printf("(empty table)\n");
+  }
+  return 0;
+}
@@ -0,0 +1,165 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    scan_matcher_test.cc
+\brief   Checks that the branch and bound scan matcher returns the same
+         candidate as the exhaustive search, on one thread and on several,
+         over random rooms, lattices, tied scores and empty scans.
+*/
+//========================================================================
+
+#include <stdio.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "eigen3/Eigen/Geometry"
+
+#include "slam/likelihood_raster.h"
+#include "slam/scan_matcher.h"
+
+using Eigen::Rotation2Df;
+using Eigen::Vector2f;
+using slam::CandidateLattice;
+using slam::LikelihoodRaster;
+using slam::ScanMatcher;
+using std::vector;
+
+namespace {
+
+const int kNumTrials = 200;
+const int kNumThreads = 4;
+const float kResolution = 0.01;
+const float kObsWeight = 3.0 / 1000;
+
+// Lattices of each shape: a single candidate, the 3x3x3 lattice SLAM
+// searches, a non-square one, and a wide one that BranchAndBound prunes
+// hard.
+struct Shape {
+  int num_x;
+  int num_y;
+  int num_angles;
+  float window;
+};
+const Shape kShapes[] = {
+  {1, 1, 1, 1},
+  {3, 3, 3, 1},
+  {12, 17, 7, 3},
+  {31, 31, 30, 10},
+};
+
+}  // namespace
+
+int main() {
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<float> u(-1, 1);
+  LikelihoodRaster table;
+  table.Init(Vector2f(-8, -8), Vector2f(8, 8), kResolution, 10, 0.01);
+  ScanMatcher matcher;
+  CandidateLattice candidates;
+  int errors = 0;
+  for (int trial = 0; trial < kNumTrials; ++trial) {
+    // A rectangular room about the robot, with clutter in some trials.
+    const Vector2f robot(3 * u(gen), 3 * u(gen));
+    table.Clear();
+    table.Recenter(robot);
+    const float w = 2 + u(gen);
+    const float h = 2 + u(gen);
+    vector<Vector2f> walls;
+    for (float t = -1; t <= 1; t += 0.002f) {
+      walls.push_back(robot + Vector2f(t * w, h));
+      walls.push_back(robot + Vector2f(t * w, -h));
+      walls.push_back(robot + Vector2f(w, t * h));
+      walls.push_back(robot + Vector2f(-w, t * h));
+    }
+    if (trial % 3 == 0) {
+      for (int k = 0; k < 200; ++k) {
+        walls.push_back(robot + 3 * Vector2f(u(gen), u(gen)));
+      }
+    }
+    for (const Vector2f& p : walls) table.Stamp(p);
+    table.UpdatePyramid();
+
+    // The scan, taken from a pose near the robot, with noise in some trials.
+    // Some scans are empty, or lie wholly outside the raster, so that every
+    // candidate scores the same but for its motion model log likelihood.
+    const Vector2f scan_loc = robot + 0.05 * Vector2f(u(gen), u(gen));
+    const Rotation2Df to_scan(-0.05 * u(gen));
+    vector<Vector2f> points;
+    for (size_t i = 0; i < walls.size(); i += 40) {
+      Vector2f p = to_scan * (walls[i] - scan_loc);
+      if (trial % 5 == 0) p += 0.03 * Vector2f(u(gen), u(gen));
+      points.push_back(p);
+    }
+    if (trial % 17 == 0) points.clear();
+    if (trial % 19 == 0) {
+      for (Vector2f& p : points) p += Vector2f(100, 100);
+    }
+
+    // Without the motion model, tied candidates only differ by index.
+    const float motion_weight = (trial % 7 == 0) ? 0 : 1.0 / 3;
+    const Shape& shape = kShapes[trial % 4];
+    const float stddev = 0.05 + 0.05 * fabs(u(gen));
+    candidates.Init(robot, 0, stddev, stddev, 0.02, shape.num_x, shape.num_y,
+                    shape.num_angles, shape.window, kResolution);
+
+    const int expected = matcher.Exhaustive(table, points, candidates,
+                                            kObsWeight, motion_weight, 1);
+    const int results[] = {
+      matcher.Exhaustive(table, points, candidates, kObsWeight,
+                         motion_weight, kNumThreads),
+      matcher.BranchAndBound(table, points, candidates, kObsWeight,
+                             motion_weight, 1),
+      matcher.BranchAndBound(table, points, candidates, kObsWeight,
+                             motion_weight, kNumThreads),
+    };
+    const char* names[] = {
+      "exhaustive, parallel",
+      "branch and bound",
+      "branch and bound, parallel",
+    };
+    for (int i = 0; i < 3; ++i) {
+      if (results[i] != expected) {
+        printf("trial %d, %dx%dx%d lattice: %s found %d, exhaustive %d\n",
+               trial, shape.num_x, shape.num_y, shape.num_angles, names[i],
+               results[i], expected);
+        ++errors;
+      }
+    }
+    // With nothing to tell the candidates apart, the lowest index wins.
+    if (motion_weight == 0 && points.empty() && expected != 0) {
+      printf("trial %d: tied candidates gave %d, not 0\n", trial, expected);
+      ++errors;
+    }
+  }
+
+  // An empty lattice has no best candidate.
+  candidates.Init(Vector2f(0, 0), 0, 0.1, 0.1, 0.02, 0, 0, 0, 1, kResolution);
+  const vector<Vector2f> points(10, Vector2f(1, 0));
+  for (const int threads : {1, kNumThreads}) {
+    if (matcher.Exhaustive(table, points, candidates, kObsWeight, 1,
+                           threads) != -1 ||
+        matcher.BranchAndBound(table, points, candidates, kObsWeight, 1,
+                               threads) != -1) {
+      printf("empty lattice, %d threads: found a candidate\n", threads);
+      ++errors;
+    }
+  }
+
+  printf("%d trials: %s\n", kNumTrials, (errors == 0) ? "PASS" : "FAIL");
+  return (errors == 0) ? 0 : 1;
+}
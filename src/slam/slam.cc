@@ -22,6 +22,9 @@
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "eigen3/Eigen/Dense"
 #include "eigen3/Eigen/Geometry"
 #include "gflags/gflags.h"
@@ -55,7 +58,14 @@ SLAM::SLAM() :
     odom_initialized_(false),
     x_resolution(3),
     y_resolution(3),
-    theta_resolution(30) {}
+    theta_resolution(3),
+    search_window(1) {
+#ifdef _OPENMP
+  num_threads = omp_get_max_threads();
+#else
+  num_threads = 1;
+#endif
+}
 
 void SLAM::GetPose(Eigen::Vector2f* loc, float* angle) const {
   // Return the latest pose estimate of the robot.
@@ -66,62 +76,28 @@ void SLAM::GetPose(Eigen::Vector2f* loc, float* angle) const {
 
 Pose SLAM::CorrelativeScanMatching(const vector<float>& ranges, float angle_min, float angle_max)
 {
-  Pose new_pose;
-  float best_likelihood = -100000;
-
-  float angle_diff = (angle_max - angle_min) / ranges.size();
-  float cur_angle;
-   // std::cout << "checkpoint 1 " << poses.size() << std::endl;
-  for( unsigned int i=0; i<poses.size(); i++ )
+  // Every skip_scans-th beam endpoint in the new base link frame, computed
+  // once for all candidate poses.
+  const scan_geometry::BeamDirections& directions =
+      scan_geometry::UpdateBeamDirections(angle_min, angle_max, ranges.size(),
+                                          &beam_directions_);
+  scan_points_.clear();
+  if (obs_prob_table_init)
   {
-    float obs_log_likelihood = 0.0;
-    cur_angle = angle_min;
-
-    unsigned int j = 0;
-    // std::cout << j << " " << ranges.size() << std::endl;
-    // std::cout << "checkpoint 1 inside first " << i << " " << ranges.size() << std::endl;
-    while(j < ranges.size())
-    {
-      // std::cout << j << " start ";
-      if(ranges[j] > 9)
-      {
-        cur_angle += angle_diff*skip_scans;
-        j += 1*skip_scans;
-        continue;
-      }
-      Eigen::Vector2f current_point_in_new_base_link;
-      current_point_in_new_base_link.x() = ranges[j] * cos(cur_angle) + 0.2;
-      current_point_in_new_base_link.y() = ranges[j] * sin(cur_angle);
-
-      Eigen::Vector2f query_location = convert_scan_prev_pose( poses[i], current_point_in_new_base_link );
-
-
-      if(obs_prob_table_init)
-      {
-        obs_log_likelihood += obs_prob_table[ int((query_location.x() - min_x_val) / delta_distance) ][ int( (query_location.y() - min_y_val) / delta_distance
-      ) ];
-
-      }
-
-      cur_angle += angle_diff*skip_scans;
-      j += 1*skip_scans;
-      // std::cout << j << std::endl;
-    }
-
-    // std::cout << "checkpoint 1 inside " << i << std::endl;
-
-    float cur_particle_likelihood = obs_weight * obs_log_likelihood + motion_weight * poses[i].log_likelihood;
-    // float cur_particle_likelihood = motion_weight * poses[i].log_likelihood;
-    if(cur_particle_likelihood > best_likelihood)
-    {
-      best_likelihood = cur_particle_likelihood;
-      new_pose = poses[i];
+    for (size_t j = 0; j < ranges.size(); j += skip_scans) {
+      if (ranges[j] > 9) continue;
+      scan_points_.push_back(ranges[j] * directions.Direction(j) +
+                             Vector2f(0.2, 0));
     }
-    // Need to add code which computes log likelihood of this pose with max and updates accordingly
-
   }
-  // std::cout << "checkpoint 2" << std::endl;
-  return new_pose;
+
+  // The table is in the map frame: the points are looked up at each
+  // candidate pose.
+  const int best = scan_matcher_.BranchAndBound(
+      obs_prob_table, scan_points_, candidates_, obs_weight, motion_weight,
+      num_threads);
+  if (best < 0) return current_pose;
+  return candidates_.Get(best);
 }
 
 
@@ -139,15 +115,14 @@ Eigen::Vector2f SLAM::convert_scan_prev_pose(Pose particle_pose, Eigen::Vector2f
 
 void SLAM::construct_obs_prob_table()
 {
-  obs_prob_table_width = (max_x_val - min_x_val) / delta_distance;
-  obs_prob_table_height = (max_y_val - min_y_val) / delta_distance;
-
-  obs_prob_table.resize(obs_prob_table_width);
-  for(int i=0; i<obs_prob_table_width; i++)
-  {
-    obs_prob_table[i].resize( obs_prob_table_height );
-    for(int j=0; j<obs_prob_table_height; j++) obs_prob_table[i][j] = -100000;
+  // Allocated on the first scan. Later scans only scroll the window to the
+  // robot, which resets the strips of cells that enter it.
+  if (obs_prob_table.Width() == 0) {
+    obs_prob_table.Init(Vector2f(min_x_val, min_y_val),
+                        Vector2f(max_x_val, max_y_val),
+                        delta_distance, 10, obs_variance);
   }
+  obs_prob_table.Recenter(current_best_pose.loc);
 }
 
 
@@ -173,20 +148,23 @@ void SLAM::ObserveLaser(const vector<float>& ranges,
   add_new_points_in_map(current_best_pose, ranges, angle_min, angle_max );
 
   construct_obs_prob_table();
-  float angle_diff = (angle_max - angle_min) / ranges.size();
-  float cur_angle = angle_min;
+  const scan_geometry::BeamDirections& directions =
+      scan_geometry::UpdateBeamDirections(angle_min, angle_max, ranges.size(),
+                                          &beam_directions_);
+  const Eigen::Matrix2f rotation =
+      Rotation2Df(current_best_pose.angle).toRotationMatrix();
 
 
 
+  // Add the scan to the table, in the map frame.
   for(unsigned int i=0; i<ranges.size(); i++)
   {
-    Eigen::Vector2f current_point;
-    current_point.x() = ranges[i] * cos(cur_angle) + 0.2;
-    current_point.y() = ranges[i] * sin(cur_angle);
+    const Vector2f current_point = current_best_pose.loc + rotation *
+        (ranges[i] * directions.Direction(i) + Vector2f(0.2, 0));
     // std::cout << "checkpoint in " << i << " " << obs_prob_table_width << " " << obs_prob_table_height << " " << current_point.x() << " " << ranges.size() << std::endl;
     makeProbTable(current_point);
-    cur_angle += angle_diff;
   }
+  obs_prob_table.UpdatePyramid();
   obs_prob_table_init = true;
   use_laser = false;
   rotation_matrix = Eigen::Rotation2Df(current_best_pose.angle - prev_odom_angle_);
@@ -199,24 +177,7 @@ void SLAM::ObserveLaser(const vector<float>& ranges,
 
 void SLAM::makeProbTable(Eigen::Vector2f point)
 {
-  int ind_x = (point.x() - min_x_val) / delta_distance;
-  int ind_y = (point.y() - min_y_val) / delta_distance;
-
-  int iter_x_min = max(ind_x - 10, 0);
-  int iter_y_min = max(ind_y - 10, 0);
-  int iter_x_max = min(ind_x + 10, obs_prob_table_width - 1);
-  int iter_y_max = min(ind_y + 10, obs_prob_table_height - 1);
-
-  // std::cout << iter_x_min << " " << iter_x_max << " " << iter_y_min << " " << iter_y_max << endl;
-
-  for(int x_iter = iter_x_min; x_iter <= iter_x_max; x_iter++)
-  {
-    for(int y_iter = iter_y_min; y_iter <= iter_y_max; y_iter++)
-    {
-      float cur_ll = - ( pow( (ind_x - x_iter)*delta_distance , 2) + pow(  (ind_y - y_iter)*delta_distance , 2 ) ) / obs_variance;
-      obs_prob_table[ x_iter][ y_iter ] = max(obs_prob_table[ x_iter][ y_iter ], cur_ll);
-    }
-  }
+  obs_prob_table.Stamp(point);
 }
 
 
@@ -235,16 +196,16 @@ Vector2f SLAM::rotation( Eigen::Vector2f local_frame_loc, float local_frame_angl
 
 void SLAM::add_new_points_in_map(Pose current_best_pose, const vector<float>& ranges, float angle_min, float angle_max)
 {
-  float angle_diff = (angle_max - angle_min) / ranges.size();
-  float cur_angle = angle_min + current_best_pose.angle;
-  int i=0;
-  while( angle_max > cur_angle )
+  // Every beam endpoint, rotated into the map frame by the pose heading.
+  const scan_geometry::BeamDirections& directions =
+      scan_geometry::UpdateBeamDirections(angle_min, angle_max, ranges.size(),
+                                          &beam_directions_);
+  const float c = cos(current_best_pose.angle);
+  const float s = sin(current_best_pose.angle);
+  for (size_t i = 0; i < ranges.size(); ++i)
   {
-    Eigen::Vector2f range_point(ranges[i], 0.0);
-    Eigen::Vector2f new_point = rotation( current_best_pose.loc, cur_angle, range_point );
-    constructed_map.push_back(new_point);
-    cur_angle += angle_diff;
-    i++;
+    constructed_map.push_back(
+        current_best_pose.loc + ranges[i] * directions.Rotated(i, c, s));
   }
   return;
 }
@@ -285,43 +246,12 @@ void SLAM::motion_model(float distance, float angle, float x_translation_error_s
   //double rotation_error_stdev= k3*magnitude_of_transform+ k4*magnitude_of_rotation;
 
 
-  // iterate through every cell in 3d motion model lookup table
-
-  for(int i=0;i<x_resolution;i++){
-    for(int j=0; j<y_resolution;j++){
-      for(int k=0; k<theta_resolution; k++){
-
-
-
-        float x_delta=x_translation_error_stddev*(2*i/(x_resolution-1)-1);
-        float y_delta = y_translation_error_stddev*(2*j/(y_resolution-1)-1);
-        float angle_delta= rotation_error_stddev*(2*k/(theta_resolution-1)-1);
-
-        float x_likelihood = -(pow(x_delta/x_translation_error_stddev, 2));
-        float y_likelihood = -(pow(y_delta/y_translation_error_stddev, 2));
-        float angle_likelihood = -(pow(angle_delta/rotation_error_stddev, 2));
-        //Eigen::Vector2f distance_noise(x_translation_error_stdev,y_translation_error_stdev);
-        Eigen::Vector2f angle_rotation(cos(angle),sin(angle));
-        //whatever current location variable is assumed its called current_loc and current_angle
-        //pose(0): x_loc pose(1) , y_loc , pose(2) theta , log likelihood
-
-
-
-        float log_likelihood= x_likelihood+y_likelihood+angle_likelihood;
-        Eigen::Vector4d temp( current_pose.loc.x() + x_delta*cos(current_pose.angle) - y_delta*sin(current_pose.angle), current_pose.loc.y() + x_delta*sin(current_pose.angle) + y_delta*cos(current_pose.angle), current_pose.angle+angle_delta,log_likelihood);
-        Pose new_pose;
-        new_pose.log_likelihood=temp(3);
-        new_pose.loc= Eigen::Vector2f(temp(0),temp(1));
-        new_pose.angle= temp(2);
-        //all poses for current time step
-        poses.push_back(new_pose);
-
-        // std::cout << i << " " << j << " " << k << " " << new_pose.loc << " " << current_loc << std::endl;
-
-      }
-    }
-  }
-
+  // Lattice of x_resolution x y_resolution x theta_resolution poses about the
+  // predicted pose, spanning search_window standard deviations each way.
+  candidates_.Init(current_pose.loc, current_pose.angle,
+                   x_translation_error_stddev, y_translation_error_stddev,
+                   rotation_error_stddev, x_resolution, y_resolution,
+                   theta_resolution, search_window, delta_distance);
 }
 
 
@@ -385,7 +315,6 @@ void SLAM::ObserveOdometry(const Vector2f& odom_loc, const float odom_angle) {
     double x_translation_error_stdev= k1*distance+ k2*magnitude_of_rotation;
     double y_translation_error_stdev= k1*distance+ k2*magnitude_of_rotation;
     double rotation_error_stdev= k3*distance+ k4*magnitude_of_rotation;
-    poses.clear();
     motion_model(distance,angle,x_translation_error_stdev,y_translation_error_stdev,rotation_error_stdev);
 
     use_laser = true;
@@ -20,10 +20,14 @@
 //========================================================================
 
 #include <algorithm>
+#include <memory>
 #include <vector>
 
 #include "eigen3/Eigen/Dense"
 #include "eigen3/Eigen/Geometry"
+#include "scan_geometry/beam_directions.h"
+#include "slam/likelihood_raster.h"
+#include "slam/scan_matcher.h"
 
 #ifndef SRC_SLAM_H_
 #define SRC_SLAM_H_
@@ -32,13 +36,6 @@ using namespace std;
 
 namespace slam {
 
-struct Pose {
-  Eigen::Vector2f loc;
-  float angle;
-  float log_likelihood = 0.0;
-};
-
-
 class SLAM {
  public:
   // Default Constructor.
@@ -80,18 +77,18 @@ class SLAM {
   Pose current_best_pose;
   Pose current_pose;
 
+  // Extent of the observation likelihood table about the robot, in meters.
   // Keep symetric in x and y direction
   int min_x_val = -8;
   int max_x_val = 8;
   int min_y_val = -8;
   int max_y_val = 8;
 
-  // Observation likelihood table
-  int obs_prob_table_width;
-  int obs_prob_table_height;
+  // Observation likelihood table: the scans in a window of the map about
+  // the robot.
   int skip_scans = 10;
   float delta_distance = 0.01;
-  vector< vector<float> > obs_prob_table;
+  LikelihoodRaster obs_prob_table;
   float std_obs_likelihood = 0.01;
 
   //CorrelativeScanMatching
@@ -110,10 +107,22 @@ class SLAM {
   bool calculate_likelihoods;
   bool obs_prob_table_init = false;
   bool use_laser = false;
-  std::vector<Pose> poses;
+  // Candidate poses for the next scan, from the motion model.
+  CandidateLattice candidates_;
+  ScanMatcher scan_matcher_;
+  // Beam directions of the current scan geometry.
+  std::shared_ptr<const scan_geometry::BeamDirections> beam_directions_;
+  // Scored beam endpoints of the current scan in the base link frame, shared
+  // by all candidate poses of CorrelativeScanMatching.
+  std::vector<Eigen::Vector2f> scan_points_;
   int x_resolution;
   int y_resolution;
   int theta_resolution;
+  // Half width of the candidate lattice, in standard deviations of the
+  // motion model.
+  float search_window;
+  // Number of threads scoring the candidate poses.
+  int num_threads;
 };
 }  // namespace slam
 
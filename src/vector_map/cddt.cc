@@ -0,0 +1,232 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    cddt.cc
+\brief   Compressed directional distance transform, for ray casting against
+         a vector map with a table lookup.
+*/
+//========================================================================
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "shared/util/timer.h"
+#include "cddt.h"
+#include "map_cache.h"
+
+using geometry::line2f;
+using std::pair;
+using std::string;
+using std::vector;
+using Eigen::Vector2f;
+
+namespace vector_map {
+
+CDDT::CDDT() : lane_width_(0), num_theta_(0) {}
+
+bool CDDT::BuiltFor(const string& map_file,
+                    float lane_width,
+                    int num_theta) const {
+  return !slices_.empty() &&
+      map_file == map_file_ &&
+      lane_width == lane_width_ &&
+      num_theta == num_theta_;
+}
+
+size_t CDDT::MemoryUsage() const {
+  return slices_.size() * sizeof(Slice) +
+      lane_start_.size() * sizeof(uint32_t) +
+      zeros_.size() * sizeof(float);
+}
+
+bool CDDT::Build(const vector<line2f>& lines,
+                 const string& map_file,
+                 float lane_width,
+                 int num_theta,
+                 const std::atomic<bool>* cancel) {
+  static CumulativeFunctionTimer function_timer_(__FUNCTION__);
+  CumulativeFunctionTimer::Invocation invoke(&function_timer_);
+  map_file_ = map_file;
+  lane_width_ = lane_width;
+  num_theta_ = num_theta;
+  slices_.clear();
+  lane_start_.clear();
+  zeros_.clear();
+  if (lines.empty() || lane_width <= 0 || num_theta <= 0) return true;
+
+  // Scratch list of (lane, u) crossings for one slice.
+  vector<pair<int, float> > crossings;
+  for (int k = 0; k < num_theta; ++k) {
+    if (cancel != nullptr && *cancel) {
+      slices_.clear();
+      return false;
+    }
+    const float phi = M_PI * static_cast<float>(k) / num_theta;
+    Slice slice;
+    slice.cos_phi = cos(phi);
+    slice.sin_phi = sin(phi);
+    slice.first_lane = lane_start_.size();
+
+    // Extent of the rotated map along v.
+    float v_min = std::numeric_limits<float>::max();
+    float v_max = -std::numeric_limits<float>::max();
+    for (const line2f& l : lines) {
+      const float v0 = -l.p0.x() * slice.sin_phi + l.p0.y() * slice.cos_phi;
+      const float v1 = -l.p1.x() * slice.sin_phi + l.p1.y() * slice.cos_phi;
+      v_min = std::min(v_min, std::min(v0, v1));
+      v_max = std::max(v_max, std::max(v0, v1));
+    }
+    slice.v_min = v_min;
+    slice.num_lanes =
+        static_cast<int>(floor((v_max - v_min) / lane_width)) + 1;
+
+    // Each lane is represented by the ray through its center line. A line
+    // that crosses the center of a lane adds a zero point where it crosses;
+    // a line that ends within a lane adds its closest end.
+    crossings.clear();
+    for (const line2f& l : lines) {
+      float u0 = l.p0.x() * slice.cos_phi + l.p0.y() * slice.sin_phi;
+      float v0 = -l.p0.x() * slice.sin_phi + l.p0.y() * slice.cos_phi;
+      float u1 = l.p1.x() * slice.cos_phi + l.p1.y() * slice.sin_phi;
+      float v1 = -l.p1.x() * slice.sin_phi + l.p1.y() * slice.cos_phi;
+      if (v0 > v1) {
+        std::swap(u0, u1);
+        std::swap(v0, v1);
+      }
+      const int lane_min = static_cast<int>((v0 - v_min) / lane_width);
+      const int lane_max = static_cast<int>((v1 - v_min) / lane_width);
+      for (int j = lane_min; j <= lane_max; ++j) {
+        const float v_center = v_min + (j + 0.5f) * lane_width;
+        if (v1 - v0 < 1e-6f) {
+          // Parallel to the lane: both ends are possible first hits.
+          crossings.push_back(std::make_pair(j, u0));
+          crossings.push_back(std::make_pair(j, u1));
+          continue;
+        }
+        const float v = std::min(v1, std::max(v0, v_center));
+        crossings.push_back(
+            std::make_pair(j, u0 + (u1 - u0) * (v - v0) / (v1 - v0)));
+      }
+    }
+    std::sort(crossings.begin(), crossings.end());
+    size_t c = 0;
+    for (int j = 0; j < slice.num_lanes; ++j) {
+      lane_start_.push_back(zeros_.size());
+      for (; c < crossings.size() && crossings[c].first == j; ++c) {
+        zeros_.push_back(crossings[c].second);
+      }
+    }
+    lane_start_.push_back(zeros_.size());
+    slices_.push_back(slice);
+  }
+  return true;
+}
+
+// Version of the cache file format, to bump whenever it changes.
+static const uint32_t kCDDTCacheVersion = 1;
+
+bool CDDT::SaveCache(const string& cache_file) const {
+  CacheWriter writer("cddt", kCDDTCacheVersion);
+  writer.Write(lane_width_);
+  writer.Write(num_theta_);
+  writer.WriteArray(slices_);
+  writer.WriteArray(lane_start_);
+  writer.WriteArray(zeros_);
+  return writer.Save(cache_file);
+}
+
+bool CDDT::LoadCache(const string& cache_file, const string& map_file) {
+  static CumulativeFunctionTimer function_timer_(__FUNCTION__);
+  CumulativeFunctionTimer::Invocation invoke(&function_timer_);
+  CacheReader reader;
+  float lane_width = 0;
+  int num_theta = 0;
+  vector<Slice> slices;
+  vector<uint32_t> lane_start;
+  vector<float> zeros;
+  if (!reader.Open(cache_file, "cddt", kCDDTCacheVersion) ||
+      !reader.Read(&lane_width) ||
+      !reader.Read(&num_theta) ||
+      !reader.ReadArray(&slices) ||
+      !reader.ReadArray(&lane_start) ||
+      !reader.ReadArray(&zeros) ||
+      !reader.Done() ||
+      static_cast<int>(slices.size()) != num_theta) {
+    return false;
+  }
+  // Check the offsets, as Range trusts them.
+  for (const Slice& slice : slices) {
+    if (slice.num_lanes < 0 ||
+        slice.first_lane + slice.num_lanes >= lane_start.size()) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < lane_start.size(); ++i) {
+    if (lane_start[i] > zeros.size() ||
+        (i > 0 && lane_start[i] < lane_start[i - 1])) {
+      return false;
+    }
+  }
+  map_file_ = map_file;
+  lane_width_ = lane_width;
+  num_theta_ = num_theta;
+  slices_.swap(slices);
+  lane_start_.swap(lane_start);
+  zeros_.swap(zeros);
+  return true;
+}
+
+float CDDT::Range(const Vector2f& p, float theta, float max_range) const {
+  if (slices_.empty()) return max_range;
+  const float kSliceWidth = M_PI / num_theta_;
+  theta -= 2.0f * M_PI * floor(theta / (2.0f * M_PI));
+  bool backwards = false;
+  if (theta >= M_PI) {
+    theta -= M_PI;
+    backwards = true;
+  }
+  int k = static_cast<int>(theta / kSliceWidth + 0.5f);
+  if (k >= num_theta_) {
+    // Closer to pi than to the last slice: the opposite of slice 0.
+    k = 0;
+    backwards = !backwards;
+  }
+  const Slice& slice = slices_[k];
+  const float u = p.x() * slice.cos_phi + p.y() * slice.sin_phi;
+  const float v = -p.x() * slice.sin_phi + p.y() * slice.cos_phi;
+  const float lane_f = (v - slice.v_min) / lane_width_;
+  if (lane_f < 0 || lane_f >= slice.num_lanes) return max_range;
+  const int lane = slice.first_lane + static_cast<int>(lane_f);
+  const float* begin = zeros_.data() + lane_start_[lane];
+  const float* end = zeros_.data() + lane_start_[lane + 1];
+  if (backwards) {
+    const float* it = std::lower_bound(begin, end, u);
+    if (it == begin) return max_range;
+    return std::min(max_range, u - *(it - 1));
+  }
+  const float* it = std::upper_bound(begin, end, u);
+  if (it == end) return max_range;
+  return std::min(max_range, *it - u);
+}
+
+}  // namespace vector_map
@@ -0,0 +1,100 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    cddt.h
+\brief   Compressed directional distance transform, for ray casting against
+         a vector map with a table lookup.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "math/line2d.h"
+
+#ifndef CDDT_H
+#define CDDT_H
+
+namespace vector_map {
+
+// Compressed directional distance transform (Walsh and Karaman, 2017).
+// For each of num_theta directions in [0, pi), the map is rotated so that the
+// direction lies along the u axis, and sliced into lanes of constant v. Each
+// lane stores the sorted u coordinates where map lines cross it. A ray cast is
+// then a binary search in one lane: forwards for directions in [0, pi), and
+// backwards for the opposite directions in [pi, 2 pi).
+class CDDT {
+ public:
+  CDDT();
+
+  // Build the table for the given map lines. Lanes are lane_width meters
+  // wide, and the angular resolution is pi / num_theta. Building may be
+  // aborted by setting *cancel, in which case this returns false.
+  bool Build(const std::vector<geometry::line2f>& lines,
+             const std::string& map_file,
+             float lane_width,
+             int num_theta,
+             const std::atomic<bool>* cancel);
+
+  // Distance from p to the first map line along the ray at angle theta,
+  // saturated at max_range.
+  float Range(const Eigen::Vector2f& p, float theta, float max_range) const;
+
+  // Returns true if the table was built for the given map and parameters.
+  bool BuiltFor(const std::string& map_file,
+                float lane_width,
+                int num_theta) const;
+
+  // Write the table to a cache file, see map_cache.h, or read it back as
+  // built from map_file. Return false on failure; a failed load leaves the
+  // table unchanged.
+  bool SaveCache(const std::string& cache_file) const;
+  bool LoadCache(const std::string& cache_file, const std::string& map_file);
+
+  // Size of the table, in bytes.
+  size_t MemoryUsage() const;
+
+ private:
+  // One direction of the table.
+  struct Slice {
+    // Direction of the u axis.
+    float cos_phi;
+    float sin_phi;
+    // v coordinate of the start of lane 0.
+    float v_min;
+    // Number of lanes in this slice.
+    int num_lanes;
+    // Index of the first lane of this slice in lane_start_.
+    uint32_t first_lane;
+  };
+
+  // Name of the map file the table was built from.
+  std::string map_file_;
+  float lane_width_;
+  int num_theta_;
+  std::vector<Slice> slices_;
+  // Offsets into zeros_ for every lane, with a trailing entry per slice.
+  std::vector<uint32_t> lane_start_;
+  // Sorted u coordinates of the line crossings, bucketed by lane.
+  std::vector<float> zeros_;
+};
+
+}  // namespace vector_map
+
+#endif  // CDDT_H
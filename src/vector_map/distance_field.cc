@@ -0,0 +1,206 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    distance_field.cc
+\brief   Euclidean distance field rasterized from a vector map.
+*/
+//========================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "shared/util/timer.h"
+#include "distance_field.h"
+#include "map_cache.h"
+
+using geometry::line2f;
+using std::string;
+using std::vector;
+using Eigen::Vector2f;
+
+namespace {
+
+// One-dimensional squared Euclidean distance transform of a sampled function
+// (Felzenszwalb and Huttenlocher, 2012). f holds n samples spaced `stride`
+// apart; the result is written back in place. v and z are scratch buffers of
+// size at least n and n + 1.
+void DistanceTransform1D(float* f,
+                         int n,
+                         int stride,
+                         vector<float>* d_ptr,
+                         vector<int>* v_ptr,
+                         vector<float>* z_ptr) {
+  static const float kInf = std::numeric_limits<float>::infinity();
+  vector<float>& d = *d_ptr;
+  vector<int>& v = *v_ptr;
+  vector<float>& z = *z_ptr;
+  int k = -1;
+  for (int q = 0; q < n; ++q) {
+    const float fq = f[q * stride];
+    if (fq == kInf) continue;
+    float s = kInf;
+    while (k >= 0) {
+      const int p = v[k];
+      s = ((fq + q * q) - (f[p * stride] + p * p)) / (2.0f * (q - p));
+      if (s > z[k]) break;
+      --k;
+    }
+    ++k;
+    v[k] = q;
+    z[k] = (k == 0) ? -kInf : s;
+    z[k + 1] = kInf;
+  }
+  if (k < 0) return;
+  int j = 0;
+  for (int q = 0; q < n; ++q) {
+    while (z[j + 1] < q) ++j;
+    const int p = v[j];
+    d[q] = (q - p) * (q - p) + f[p * stride];
+  }
+  for (int q = 0; q < n; ++q) {
+    f[q * stride] = d[q];
+  }
+}
+
+}  // namespace
+
+namespace vector_map {
+
+DistanceField::DistanceField() :
+    resolution_(0),
+    max_distance_(0),
+    origin_(0, 0),
+    width_(0),
+    height_(0) {}
+
+bool DistanceField::BuiltFor(const string& map_file,
+                             float resolution,
+                             float max_distance) const {
+  return !Empty() &&
+      map_file == map_file_ &&
+      resolution == resolution_ &&
+      max_distance == max_distance_;
+}
+
+void DistanceField::Build(const VectorMap& map,
+                          float resolution,
+                          float max_distance) {
+  static CumulativeFunctionTimer function_timer_(__FUNCTION__);
+  CumulativeFunctionTimer::Invocation invoke(&function_timer_);
+  static const float kInf = std::numeric_limits<float>::infinity();
+  map_file_ = map.file_name;
+  resolution_ = resolution;
+  max_distance_ = max_distance;
+  distances_.clear();
+  width_ = height_ = 0;
+  if (map.lines.empty() || resolution <= 0) return;
+
+  Vector2f p_min = map.lines[0].p0;
+  Vector2f p_max = map.lines[0].p0;
+  for (const line2f& l : map.lines) {
+    p_min = p_min.cwiseMin(l.p0).cwiseMin(l.p1);
+    p_max = p_max.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  const Vector2f padding(max_distance + resolution, max_distance + resolution);
+  origin_ = p_min - padding;
+  const Vector2f size = p_max + padding - origin_;
+  width_ = static_cast<int>(ceil(size.x() / resolution));
+  height_ = static_cast<int>(ceil(size.y() / resolution));
+  distances_.assign(width_ * height_, kInf);
+
+  // Rasterize every line, sampling at half the cell size so that no cell that
+  // a line passes through is skipped.
+  for (const line2f& l : map.lines) {
+    const int num_steps =
+        1 + static_cast<int>(ceil(2.0f * l.Length() / resolution));
+    for (int i = 0; i <= num_steps; ++i) {
+      const Vector2f p =
+          l.p0 + (l.p1 - l.p0) * (static_cast<float>(i) / num_steps);
+      const int x = static_cast<int>((p.x() - origin_.x()) / resolution);
+      const int y = static_cast<int>((p.y() - origin_.y()) / resolution);
+      distances_[y * width_ + x] = 0;
+    }
+  }
+
+  // Separable exact squared EDT: first along columns, then along rows.
+  const int n = std::max(width_, height_);
+  vector<float> d(n);
+  vector<int> v(n);
+  vector<float> z(n + 1);
+  for (int x = 0; x < width_; ++x) {
+    DistanceTransform1D(&distances_[x], height_, width_, &d, &v, &z);
+  }
+  for (int y = 0; y < height_; ++y) {
+    DistanceTransform1D(&distances_[y * width_], width_, 1, &d, &v, &z);
+  }
+
+  for (float& c : distances_) {
+    c = std::min(max_distance, resolution * sqrt(c));
+  }
+}
+
+// Version of the cache file format, to bump whenever it changes.
+static const uint32_t kDistanceFieldCacheVersion = 1;
+
+bool DistanceField::SaveCache(const string& cache_file) const {
+  CacheWriter writer("distance_field", kDistanceFieldCacheVersion);
+  writer.Write(resolution_);
+  writer.Write(max_distance_);
+  writer.Write(origin_.x());
+  writer.Write(origin_.y());
+  writer.Write(width_);
+  writer.Write(height_);
+  writer.WriteArray(distances_);
+  return writer.Save(cache_file);
+}
+
+bool DistanceField::LoadCache(const string& cache_file,
+                              const string& map_file) {
+  static CumulativeFunctionTimer function_timer_(__FUNCTION__);
+  CumulativeFunctionTimer::Invocation invoke(&function_timer_);
+  CacheReader reader;
+  float resolution = 0, max_distance = 0, origin_x = 0, origin_y = 0;
+  int width = 0, height = 0;
+  vector<float> distances;
+  if (!reader.Open(cache_file, "distance_field", kDistanceFieldCacheVersion) ||
+      !reader.Read(&resolution) ||
+      !reader.Read(&max_distance) ||
+      !reader.Read(&origin_x) ||
+      !reader.Read(&origin_y) ||
+      !reader.Read(&width) ||
+      !reader.Read(&height) ||
+      !reader.ReadArray(&distances) ||
+      !reader.Done() ||
+      width < 0 || height < 0 ||
+      distances.size() != static_cast<size_t>(width) * height) {
+    return false;
+  }
+  map_file_ = map_file;
+  resolution_ = resolution;
+  max_distance_ = max_distance;
+  origin_ = Vector2f(origin_x, origin_y);
+  width_ = width;
+  height_ = height;
+  distances_.swap(distances);
+  return true;
+}
+
+}  // namespace vector_map
@@ -0,0 +1,90 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    distance_field.h
+\brief   Euclidean distance field rasterized from a vector map.
+*/
+//========================================================================
+
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "vector_map/vector_map.h"
+
+#ifndef DISTANCE_FIELD_H
+#define DISTANCE_FIELD_H
+
+namespace vector_map {
+
+// Grid of distances to the closest map line, saturated at a maximum
+// distance. Used as a likelihood field: the cost of scoring a point is a
+// single grid lookup, independent of the number of lines in the map.
+class DistanceField {
+ public:
+  DistanceField();
+
+  // Rasterize the lines of the map at the given resolution (meters per cell),
+  // and compute the exact Euclidean distance transform of the raster. The
+  // grid covers the bounding box of the map, padded by max_distance.
+  void Build(const VectorMap& map, float resolution, float max_distance);
+
+  // Distance from p to the closest map line, saturated at max_distance.
+  // Points outside the grid return max_distance.
+  float Distance(const Eigen::Vector2f& p) const {
+    const int x = static_cast<int>((p.x() - origin_.x()) / resolution_);
+    const int y = static_cast<int>((p.y() - origin_.y()) / resolution_);
+    if (p.x() < origin_.x() || p.y() < origin_.y() ||
+        x >= width_ || y >= height_) {
+      return max_distance_;
+    }
+    return distances_[y * width_ + x];
+  }
+
+  // Returns true if the field was built for the given map and parameters.
+  bool BuiltFor(const std::string& map_file,
+                float resolution,
+                float max_distance) const;
+
+  // Write the field to a cache file, see map_cache.h, or read it back as
+  // built from map_file. Return false on failure; a failed load leaves the
+  // field unchanged.
+  bool SaveCache(const std::string& cache_file) const;
+  bool LoadCache(const std::string& cache_file, const std::string& map_file);
+
+  bool Empty() const { return distances_.empty(); }
+  float Resolution() const { return resolution_; }
+  float MaxDistance() const { return max_distance_; }
+
+ private:
+  // Name of the map file the field was built from.
+  std::string map_file_;
+  // Size of a grid cell, in meters.
+  float resolution_;
+  // Saturation distance, in meters.
+  float max_distance_;
+  // Location of the corner of cell (0, 0).
+  Eigen::Vector2f origin_;
+  // Grid dimensions, in cells.
+  int width_;
+  int height_;
+  // Row-major distances, in meters.
+  std::vector<float> distances_;
+};
+
+}  // namespace vector_map
+
+#endif  // DISTANCE_FIELD_H
@@ -0,0 +1,163 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    map_cache.cc
+\brief   On-disk cache of structures derived from a vector map, e.g. ray
+         cast tables and distance fields.
+*/
+//========================================================================
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "map_cache.h"
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// Identifies cache files, ahead of the kind and version of the structure.
+const char kMagic[8] = {'M', 'A', 'P', 'C', 'A', 'C', 'H', 'E'};
+
+// Create dir and its parents, like mkdir -p.
+bool MakeDirectories(const string& dir) {
+  for (size_t i = 1; i <= dir.size(); ++i) {
+    if (i < dir.size() && dir[i] != '/') continue;
+    const string prefix = dir.substr(0, i);
+    if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+namespace vector_map {
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+MappedFile::MappedFile() : data_(nullptr), size_(0) {}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+bool MappedFile::Open(const string& file) {
+  Close();
+  const int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  if (st.st_size == 0) {
+    // mmap rejects empty mappings; an empty file is simply empty.
+    close(fd);
+    return true;
+  }
+  void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the file is closed.
+  close(fd);
+  if (p == MAP_FAILED) return false;
+  data_ = static_cast<const uint8_t*>(p);
+  size_ = st.st_size;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
+
+string CacheFileName(const string& cache_dir,
+                     const string& kind,
+                     const string& map_file,
+                     const string& params) {
+  if (cache_dir.empty()) return "";
+  MappedFile map;
+  if (!map.Open(map_file)) return "";
+  uint64_t hash = HashBytes(map.data(), map.size());
+  hash = HashBytes(params.data(), params.size(), hash);
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx",
+           static_cast<unsigned long long>(hash));
+  return cache_dir + "/" + kind + "-" + name + ".bin";
+}
+
+CacheWriter::CacheWriter(const string& kind, uint32_t version) {
+  buffer_.append(kMagic, sizeof(kMagic));
+  Write(version);
+  WriteArray(vector<char>(kind.begin(), kind.end()));
+}
+
+bool CacheWriter::Save(const string& file) const {
+  const size_t slash = file.rfind('/');
+  if (slash != string::npos && slash > 0 &&
+      !MakeDirectories(file.substr(0, slash))) {
+    return false;
+  }
+  // Write to a file private to this process, then move it into place.
+  const string tmp_file = file + ".tmp" + std::to_string(getpid());
+  FILE* fid = fopen(tmp_file.c_str(), "wb");
+  if (fid == nullptr) return false;
+  const bool ok =
+      fwrite(buffer_.data(), 1, buffer_.size(), fid) == buffer_.size();
+  if (fclose(fid) != 0 || !ok || rename(tmp_file.c_str(), file.c_str()) != 0) {
+    unlink(tmp_file.c_str());
+    return false;
+  }
+  return true;
+}
+
+CacheReader::CacheReader() : offset_(0) {}
+
+bool CacheReader::Open(const string& file,
+                       const string& kind,
+                       uint32_t version) {
+  offset_ = 0;
+  if (file.empty() || !file_.Open(file)) return false;
+  char magic[sizeof(kMagic)];
+  uint32_t file_version = 0;
+  vector<char> file_kind;
+  return Read(&magic) &&
+      memcmp(magic, kMagic, sizeof(kMagic)) == 0 &&
+      Read(&file_version) &&
+      file_version == version &&
+      ReadArray(&file_kind) &&
+      string(file_kind.begin(), file_kind.end()) == kind;
+}
+
+}  // namespace vector_map
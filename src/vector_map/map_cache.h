@@ -0,0 +1,149 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    map_cache.h
+\brief   On-disk cache of structures derived from a vector map, e.g. ray
+         cast tables and distance fields.
+*/
+//========================================================================
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifndef MAP_CACHE_H
+#define MAP_CACHE_H
+
+namespace vector_map {
+
+// 64-bit FNV-1a hash of a byte string, continuing from hash.
+uint64_t HashBytes(const void* data,
+                   size_t size,
+                   uint64_t hash = 0xcbf29ce484222325ULL);
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  // Map the file, replacing any previous mapping. Returns false if the file
+  // can not be read.
+  bool Open(const std::string& file);
+  void Close();
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  // Disable copy constructor.
+  MappedFile(const MappedFile&);
+
+  const uint8_t* data_;
+  size_t size_;
+};
+
+// Name of the cache file, in cache_dir, for a structure of the given kind
+// built from map_file with the given parameters. The name holds a hash of
+// the contents of the map file and of the parameters, so editing the map or
+// changing a parameter leads to a different file. Returns an empty string if
+// cache_dir is empty (caching disabled) or the map file can not be read.
+std::string CacheFileName(const std::string& cache_dir,
+                          const std::string& kind,
+                          const std::string& map_file,
+                          const std::string& params);
+
+// Serializes a structure for the cache: a header with the kind of structure
+// and the version of its format, followed by plain data fields in the order
+// they are written. Files are in the byte order of the host.
+class CacheWriter {
+ public:
+  CacheWriter(const std::string& kind, uint32_t version);
+
+  template <typename T>
+  void Write(const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only plain data can be cached");
+    buffer_.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  // Write the size of the array, then its elements.
+  template <typename T, typename Allocator>
+  void WriteArray(const std::vector<T, Allocator>& values) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only plain data can be cached");
+    Write<uint64_t>(values.size());
+    buffer_.append(reinterpret_cast<const char*>(values.data()),
+                   values.size() * sizeof(T));
+  }
+
+  // Write everything written so far to file, creating the directories on its
+  // path as needed. The file is replaced atomically, so concurrent readers
+  // see either the old or the new contents. Returns false on failure.
+  bool Save(const std::string& file) const;
+
+ private:
+  std::string buffer_;
+};
+
+// Reads back the fields written by a CacheWriter, from a memory mapping of
+// the cache file. Every read is bounds checked, so a truncated or corrupt
+// file fails to load rather than crashing.
+class CacheReader {
+ public:
+  CacheReader();
+
+  // Map the file, and check that it holds a structure of the given kind and
+  // format version. Returns false if not, or if the file does not exist.
+  bool Open(const std::string& file,
+            const std::string& kind,
+            uint32_t version);
+
+  template <typename T>
+  bool Read(T* value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only plain data can be cached");
+    if (file_.size() - offset_ < sizeof(T)) return false;
+    memcpy(value, file_.data() + offset_, sizeof(T));
+    offset_ += sizeof(T);
+    return true;
+  }
+
+  template <typename T, typename Allocator>
+  bool ReadArray(std::vector<T, Allocator>* values) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only plain data can be cached");
+    uint64_t n = 0;
+    if (!Read(&n) || n > (file_.size() - offset_) / sizeof(T)) return false;
+    values->resize(n);
+    memcpy(values->data(), file_.data() + offset_, n * sizeof(T));
+    offset_ += n * sizeof(T);
+    return true;
+  }
+
+  // Whether every byte of the file has been read.
+  bool Done() const { return offset_ == file_.size(); }
+
+ private:
+  MappedFile file_;
+  size_t offset_;
+};
+
+}  // namespace vector_map
+
+#endif  // MAP_CACHE_H
@@ -0,0 +1,145 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    map_registry.cc
+\brief   Process-wide registry of vector maps, shared read-only between
+         every consumer in the process.
+*/
+//========================================================================
+
+#include <dirent.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+
+#include "map_cache.h"
+#include "map_registry.h"
+#include "vector_map.h"
+
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+DECLARE_double(map_grid_resolution);
+
+namespace vector_map {
+
+namespace {
+
+struct RegisteredMap {
+  shared_ptr<const VectorMap> map;
+  // Modification time and size of the file when it was loaded.
+  time_t mtime;
+  off_t size;
+};
+
+struct Registry {
+  Registry() : map_dir("maps") {}
+
+  // Held while looking up and loading maps, so that every map is loaded
+  // only once.
+  std::mutex mutex;
+  string map_dir;
+  string cache_dir;
+  std::map<string, RegisteredMap> maps;
+};
+
+Registry& GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+}  // namespace
+
+void SetMapDirectory(const string& dir) {
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.map_dir = dir;
+}
+
+void SetMapCacheDirectory(const string& dir) {
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.cache_dir = dir;
+}
+
+string MapFile(const string& name) {
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  return registry.map_dir + "/" + name + ".txt";
+}
+
+int PreloadMaps() {
+  string map_dir;
+  {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    map_dir = registry.map_dir;
+  }
+  DIR* dir = opendir(map_dir.c_str());
+  if (dir == nullptr) return 0;
+  vector<string> files;
+  for (dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+    const string name = entry->d_name;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0) {
+      files.push_back(map_dir + "/" + name);
+    }
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
+  int num_loaded = 0;
+  for (const string& file : files) {
+    if (GetMap(file)) ++num_loaded;
+  }
+  return num_loaded;
+}
+
+shared_ptr<const VectorMap> GetMap(const string& file) {
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  struct stat st;
+  if (stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    return nullptr;
+  }
+  RegisteredMap& entry = registry.maps[file];
+  if (entry.map && entry.mtime == st.st_mtime && entry.size == st.st_size) {
+    return entry.map;
+  }
+  // Users of the previous version of the map keep it until they let go.
+  shared_ptr<VectorMap> map(new VectorMap());
+  const string cache_file = CacheFileName(
+      registry.cache_dir, "vector_map", file,
+      std::to_string(FLAGS_map_grid_resolution));
+  if (!map->LoadCache(cache_file, file)) {
+    map->Load(file);
+    if (!cache_file.empty() && !map->SaveCache(cache_file)) {
+      printf("Unable to write map cache file %s\n", cache_file.c_str());
+    }
+  }
+  entry.map = map;
+  entry.mtime = st.st_mtime;
+  entry.size = st.st_size;
+  return entry.map;
+}
+
+}  // namespace vector_map
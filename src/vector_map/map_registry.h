@@ -0,0 +1,58 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    map_registry.h
+\brief   Process-wide registry of vector maps, shared read-only between
+         every consumer in the process.
+*/
+//========================================================================
+
+#include <memory>
+#include <string>
+
+#include "vector_map/vector_map.h"
+
+#ifndef MAP_REGISTRY_H
+#define MAP_REGISTRY_H
+
+namespace vector_map {
+
+// Every map file is parsed and indexed once per process, and then shared
+// read-only by all of its users, e.g. particle filters and planners: a map
+// is not duplicated in memory, and switching maps is a pointer swap. A map
+// is reloaded only if its file changes on disk. All functions are safe to
+// call from any thread.
+
+// Directory holding the map files, "maps" by default.
+void SetMapDirectory(const std::string& dir);
+
+// Directory to cache parsed maps in, see map_cache.h. Empty, the default,
+// disables the cache.
+void SetMapCacheDirectory(const std::string& dir);
+
+// File of the map with the given name: <map directory>/<name>.txt.
+std::string MapFile(const std::string& name);
+
+// Load every map file in the map directory, so that later lookups do not
+// wait for a load. Returns the number of maps loaded.
+int PreloadMaps();
+
+// The map loaded from file, loaded on the first call. Returns null if the
+// file can not be read.
+std::shared_ptr<const VectorMap> GetMap(const std::string& file);
+
+}  // namespace vector_map
+
+#endif  // MAP_REGISTRY_H
@@ -22,6 +22,7 @@
 #include "stdio.h"
 
 #include <algorithm>
+#include <limits>
 #include <utility>
 #include <vector>
 
@@ -33,6 +34,7 @@
 #include "shared/math/line2d.h"
 #include "shared/math/math_util.h"
 #include "shared/util/timer.h"
+#include "map_cache.h"
 #include "vector_map.h"
 
 using math_util::AngleMod;
@@ -54,9 +56,89 @@ using std::swap;
 DEFINE_double(min_line_length,
               0.05,
               "Minimum line length to consider for Analytic ray casting");
+DEFINE_double(map_grid_resolution,
+              1.0,
+              "Cell size of the spatial index over map lines, in meters");
 
 namespace vector_map {
 
+namespace {
+
+// Call fn(cell) for every cell of the grid that the line touches. Cells are
+// padded by a small margin, so that lines passing exactly through a cell
+// corner are added to all the cells sharing that corner.
+template <typename Fn>
+void ForEachLineCell(const LineGrid& grid, const line2f& l, Fn fn) {
+  const float eps = 1e-3 * grid.resolution;
+  const Vector2f p0 = l.p0 - grid.origin;
+  const Vector2f p1 = l.p1 - grid.origin;
+  const float y_min = std::min(p0.y(), p1.y());
+  const float y_max = std::max(p0.y(), p1.y());
+  const int row_min = std::max(0,
+      static_cast<int>(floor((y_min - eps) / grid.resolution)));
+  const int row_max = std::min(grid.height - 1,
+      static_cast<int>(floor((y_max + eps) / grid.resolution)));
+  for (int row = row_min; row <= row_max; ++row) {
+    // Part of the line that lies within this row.
+    const float band_min = std::max(y_min, row * grid.resolution - eps);
+    const float band_max =
+        std::min(y_max, (row + 1) * grid.resolution + eps);
+    float x_min = std::min(p0.x(), p1.x());
+    float x_max = std::max(p0.x(), p1.x());
+    if (p1.y() != p0.y()) {
+      const float xa = p0.x() + (p1.x() - p0.x()) *
+          (band_min - p0.y()) / (p1.y() - p0.y());
+      const float xb = p0.x() + (p1.x() - p0.x()) *
+          (band_max - p0.y()) / (p1.y() - p0.y());
+      x_min = std::min(xa, xb);
+      x_max = std::max(xa, xb);
+    }
+    const int col_min = std::max(0,
+        static_cast<int>(floor((x_min - eps) / grid.resolution)));
+    const int col_max = std::min(grid.width - 1,
+        static_cast<int>(floor((x_max + eps) / grid.resolution)));
+    for (int col = col_min; col <= col_max; ++col) {
+      fn(row * grid.width + col);
+    }
+  }
+}
+
+}  // namespace
+
+void LineGrid::Build(const vector<line2f>& lines, float cell_size) {
+  cell_start.clear();
+  line_indices.clear();
+  width = height = 0;
+  resolution = cell_size;
+  if (lines.empty() || cell_size <= 0) return;
+  Vector2f p_min = lines[0].p0;
+  Vector2f p_max = lines[0].p0;
+  for (const line2f& l : lines) {
+    p_min = p_min.cwiseMin(l.p0).cwiseMin(l.p1);
+    p_max = p_max.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  // Pad by one cell on each side, so that every line is strictly inside.
+  origin = p_min - Vector2f(cell_size, cell_size);
+  width = static_cast<int>(ceil((p_max.x() - p_min.x()) / cell_size)) + 2;
+  height = static_cast<int>(ceil((p_max.y() - p_min.y()) / cell_size)) + 2;
+
+  // Count the lines in every cell, then fill in the buckets.
+  cell_start.assign(width * height + 1, 0);
+  for (const line2f& l : lines) {
+    ForEachLineCell(*this, l, [this](int cell) { ++cell_start[cell + 1]; });
+  }
+  for (size_t i = 1; i < cell_start.size(); ++i) {
+    cell_start[i] += cell_start[i - 1];
+  }
+  line_indices.resize(cell_start.back());
+  vector<uint32_t> fill(cell_start.begin(), cell_start.end() - 1);
+  for (size_t i = 0; i < lines.size(); ++i) {
+    ForEachLineCell(*this, lines[i], [&](int cell) {
+      line_indices[fill[cell]++] = i;
+    });
+  }
+}
+
 void TrimOcclusion(const Vector2f& loc,
                    const line2f& test_line,
                    line2f* trim_line_ptr,
@@ -194,20 +276,62 @@ void TrimOcclusion(const Vector2f& loc,
 }
 
 
-void VectorMap::GetSceneLines(const Vector2f& loc,
-                              float max_range,
-                              vector<line2f>* lines_list) const {
-  const float x_min = loc.x() - max_range;
-  const float y_min = loc.y() - max_range;
-  const float x_max = loc.x() + max_range;
-  const float y_max = loc.y() + max_range;
-  lines_list->clear();
-  for (const line2f& l : lines) {
+void VectorMap::GetLinesInBox(const Vector2f& box_min,
+                              const Vector2f& box_max,
+                              vector<uint32_t>* indices) const {
+  const float x_min = box_min.x();
+  const float y_min = box_min.y();
+  const float x_max = box_max.x();
+  const float y_max = box_max.y();
+  vector<uint32_t>& candidates = *indices;
+  candidates.clear();
+  if (grid.Empty()) {
+    for (size_t i = 0; i < lines.size(); ++i) candidates.push_back(i);
+  } else {
+    // Gather the lines from all cells overlapping the query box, in map
+    // order.
+    const int col_min = std::max(0, static_cast<int>(
+        floor((x_min - grid.origin.x()) / grid.resolution)));
+    const int col_max = std::min(grid.width - 1, static_cast<int>(
+        floor((x_max - grid.origin.x()) / grid.resolution)));
+    const int row_min = std::max(0, static_cast<int>(
+        floor((y_min - grid.origin.y()) / grid.resolution)));
+    const int row_max = std::min(grid.height - 1, static_cast<int>(
+        floor((y_max - grid.origin.y()) / grid.resolution)));
+    for (int row = row_min; row <= row_max; ++row) {
+      for (int col = col_min; col <= col_max; ++col) {
+        const int cell = row * grid.width + col;
+        candidates.insert(
+            candidates.end(),
+            grid.line_indices.begin() + grid.cell_start[cell],
+            grid.line_indices.begin() + grid.cell_start[cell + 1]);
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                     candidates.end());
+  }
+  size_t n = 0;
+  for (const uint32_t i : candidates) {
+    const line2f& l = lines[i];
     if (l.p0.x() < x_min && l.p1.x() < x_min) continue;
     if (l.p0.y() < y_min && l.p1.y() < y_min) continue;
     if (l.p0.x() > x_max && l.p1.x() > x_max) continue;
     if (l.p0.y() > y_max && l.p1.y() > y_max) continue;
-    lines_list->push_back(l);
+    candidates[n++] = i;
+  }
+  candidates.resize(n);
+}
+
+void VectorMap::GetSceneLines(const Vector2f& loc,
+                              float max_range,
+                              vector<line2f>* lines_list) const {
+  const Vector2f range(max_range, max_range);
+  vector<uint32_t> indices;
+  GetLinesInBox(loc - range, loc + range, &indices);
+  lines_list->clear();
+  for (const uint32_t i : indices) {
+    lines_list->push_back(lines[i]);
   }
 }
 
@@ -383,13 +507,308 @@ void VectorMap::Load(const string& file) {
   fclose(fid);
   Cleanup();
   file_name = file;
+  BuildIndex();
 }
 
-bool VectorMap::Intersects(const Vector2f& v0, const Vector2f& v1) const {
+// Version of the cache file format, to bump whenever it changes.
+static const uint32_t kVectorMapCacheVersion = 1;
+
+bool VectorMap::SaveCache(const string& cache_file) const {
+  CacheWriter writer("vector_map", kVectorMapCacheVersion);
+  vector<float> points;
+  points.reserve(4 * lines.size());
   for (const line2f& l : lines) {
-    if (l.Intersects(v0, v1)) return true;
+    points.push_back(l.p0.x());
+    points.push_back(l.p0.y());
+    points.push_back(l.p1.x());
+    points.push_back(l.p1.y());
+  }
+  writer.WriteArray(points);
+  writer.Write(grid.resolution);
+  writer.Write(grid.origin.x());
+  writer.Write(grid.origin.y());
+  writer.Write(grid.width);
+  writer.Write(grid.height);
+  writer.WriteArray(grid.cell_start);
+  writer.WriteArray(grid.line_indices);
+  return writer.Save(cache_file);
+}
+
+bool VectorMap::LoadCache(const string& cache_file, const string& file) {
+  static CumulativeFunctionTimer function_timer_(__FUNCTION__);
+  CumulativeFunctionTimer::Invocation invoke(&function_timer_);
+  CacheReader reader;
+  vector<float> points;
+  LineGrid new_grid;
+  float origin_x = 0, origin_y = 0;
+  if (!reader.Open(cache_file, "vector_map", kVectorMapCacheVersion) ||
+      !reader.ReadArray(&points) ||
+      !reader.Read(&new_grid.resolution) ||
+      !reader.Read(&origin_x) ||
+      !reader.Read(&origin_y) ||
+      !reader.Read(&new_grid.width) ||
+      !reader.Read(&new_grid.height) ||
+      !reader.ReadArray(&new_grid.cell_start) ||
+      !reader.ReadArray(&new_grid.line_indices) ||
+      !reader.Done() ||
+      points.size() % 4 != 0 ||
+      new_grid.resolution != static_cast<float>(FLAGS_map_grid_resolution)) {
+    return false;
+  }
+  // Check the index, as the queries trust it.
+  const size_t num_lines = points.size() / 4;
+  if (!new_grid.cell_start.empty() &&
+      (new_grid.width < 0 || new_grid.height < 0 ||
+       new_grid.cell_start.size() !=
+           static_cast<size_t>(new_grid.width) * new_grid.height + 1 ||
+       new_grid.cell_start.back() != new_grid.line_indices.size())) {
+    return false;
+  }
+  for (size_t i = 1; i < new_grid.cell_start.size(); ++i) {
+    if (new_grid.cell_start[i] < new_grid.cell_start[i - 1]) return false;
+  }
+  for (uint32_t i : new_grid.line_indices) {
+    if (i >= num_lines) return false;
+  }
+  new_grid.origin = Vector2f(origin_x, origin_y);
+  lines.clear();
+  for (size_t i = 0; i < points.size(); i += 4) {
+    lines.push_back(line2f(Vector2f(points[i], points[i + 1]),
+                           Vector2f(points[i + 2], points[i + 3])));
+  }
+  grid = new_grid;
+  file_name = file;
+  return true;
+}
+
+void VectorMap::BuildIndex() {
+  grid.Build(lines, FLAGS_map_grid_resolution);
+}
+
+bool VectorMap::Intersects(const Vector2f& v0, const Vector2f& v1) const {
+  if (grid.Empty()) {
+    for (const line2f& l : lines) {
+      if (l.Intersects(v0, v1)) return true;
+    }
+    return false;
+  }
+  bool intersects = false;
+  grid.Traverse(v0, v1, [&](int cell, float) {
+    for (uint32_t k = grid.cell_start[cell];
+         k < grid.cell_start[cell + 1] && !intersects; ++k) {
+      intersects = lines[grid.line_indices[k]].Intersects(v0, v1);
+    }
+    return intersects;
+  });
+  return intersects;
+}
+
+int VectorMap::GetClosestIntersection(const Vector2f& p0,
+                                      const Vector2f& p1,
+                                      Vector2f* intersection) const {
+  int best_idx = -1;
+  float best_sq_dist = std::numeric_limits<float>::infinity();
+  Vector2f best_point(0, 0);
+  Vector2f p(0, 0);
+  if (grid.Empty()) {
+    for (size_t i = 0; i < lines.size(); ++i) {
+      if (lines[i].Intersection(p0, p1, &p) &&
+          (p - p0).squaredNorm() < best_sq_dist) {
+        best_sq_dist = (p - p0).squaredNorm();
+        best_point = p;
+        best_idx = i;
+      }
+    }
+  } else {
+    // Walk the cells along the ray. Once the closest intersection found so far
+    // lies within the cells already visited, no later cell can beat it.
+    const float sq_length = (p1 - p0).squaredNorm();
+    grid.Traverse(p0, p1, [&](int cell, float t_exit) {
+      for (uint32_t k = grid.cell_start[cell];
+           k < grid.cell_start[cell + 1]; ++k) {
+        const int i = grid.line_indices[k];
+        if (lines[i].Intersection(p0, p1, &p) &&
+            (p - p0).squaredNorm() < best_sq_dist) {
+          best_sq_dist = (p - p0).squaredNorm();
+          best_point = p;
+          best_idx = i;
+        }
+      }
+      return best_idx >= 0 && best_sq_dist <= Sq(t_exit) * sq_length;
+    });
+  }
+  if (best_idx >= 0) *intersection = best_point;
+  return best_idx;
+}
+
+namespace {
+
+// Scratch buffers of GetPredictedRanges. Maps are shared read-only between
+// threads, so every thread keeps its own; they keep their storage between
+// calls, so steady-state ray casting does not allocate.
+struct RayCastScratch {
+  vector<float> ray_angles;
+  vector<uint32_t> indices;
+  vector<float> p0x, p0y, ex, ey;
+  vector<float> ray_cos, ray_sin;
+  vector<float> wx, wy, wex, wey, w_cross_e;
+};
+
+RayCastScratch& GetRayCastScratch() {
+  static thread_local RayCastScratch scratch;
+  return scratch;
+}
+
+}  // namespace
+
+void VectorMap::GetPredictedRanges(const float* x,
+                                   const float* y,
+                                   const float* angle,
+                                   size_t num_poses,
+                                   float range_min,
+                                   float range_max,
+                                   float angle_min,
+                                   float angle_increment,
+                                   int num_rays,
+                                   float* ranges) const {
+  if (num_rays <= 0) return;
+  vector<float>& ray_angles = GetRayCastScratch().ray_angles;
+  ray_angles.resize(num_rays);
+  for (int j = 0; j < num_rays; ++j) {
+    ray_angles[j] = angle_min + j * angle_increment;
+  }
+  GetPredictedRanges(x, y, angle, num_poses, range_min, range_max,
+                     ray_angles.data(), num_rays, ranges);
+}
+
+void VectorMap::GetPredictedRanges(const float* x,
+                                   const float* y,
+                                   const float* angle,
+                                   size_t num_poses,
+                                   float range_min,
+                                   float range_max,
+                                   const float* ray_angles,
+                                   int num_rays,
+                                   float* ranges) const {
+  if (num_poses == 0 || num_rays <= 0) return;
+  // Ray directions relative to the pose, shared by all poses.
+  RayCastScratch& scratch = GetRayCastScratch();
+  vector<float>& ray_cos = scratch.ray_cos;
+  vector<float>& ray_sin = scratch.ray_sin;
+  ray_cos.resize(num_rays);
+  ray_sin.resize(num_rays);
+  for (int j = 0; j < num_rays; ++j) {
+    ray_cos[j] = cos(ray_angles[j]);
+    ray_sin[j] = sin(ray_angles[j]);
+  }
+  GetPredictedRanges(x, y, angle, num_poses, range_min, range_max,
+                     ray_cos.data(), ray_sin.data(), num_rays, ranges);
+}
+
+void VectorMap::GetPredictedRanges(const float* x,
+                                   const float* y,
+                                   const float* angle,
+                                   size_t num_poses,
+                                   float range_min,
+                                   float range_max,
+                                   const float* ray_cos,
+                                   const float* ray_sin,
+                                   int num_rays,
+                                   float* ranges) const {
+  if (num_poses == 0 || num_rays <= 0) return;
+  // Cull the lines once for the whole batch, to those within range_max of
+  // the bounding box of the poses.
+  Vector2f box_min(x[0], y[0]);
+  Vector2f box_max(x[0], y[0]);
+  for (size_t i = 1; i < num_poses; ++i) {
+    box_min = box_min.cwiseMin(Vector2f(x[i], y[i]));
+    box_max = box_max.cwiseMax(Vector2f(x[i], y[i]));
+  }
+  RayCastScratch& scratch = GetRayCastScratch();
+  const Vector2f range(range_max, range_max);
+  vector<uint32_t>& indices = scratch.indices;
+  GetLinesInBox(box_min - range, box_max + range, &indices);
+
+  // Culled lines as flat arrays of start points and directions, for the
+  // vectorized inner loop.
+  const size_t num_lines = indices.size();
+  vector<float>& p0x = scratch.p0x;
+  vector<float>& p0y = scratch.p0y;
+  vector<float>& ex = scratch.ex;
+  vector<float>& ey = scratch.ey;
+  p0x.resize(num_lines);
+  p0y.resize(num_lines);
+  ex.resize(num_lines);
+  ey.resize(num_lines);
+  for (size_t k = 0; k < num_lines; ++k) {
+    const line2f& l = lines[indices[k]];
+    p0x[k] = l.p0.x();
+    p0y[k] = l.p0.y();
+    ex[k] = l.p1.x() - l.p0.x();
+    ey[k] = l.p1.y() - l.p0.y();
+  }
+  // Per-pose arrays of the lines within range_max of the pose, in the pose's
+  // translated frame: start points w, directions e, and cross(w, e).
+  vector<float>& wx = scratch.wx;
+  vector<float>& wy = scratch.wy;
+  vector<float>& wex = scratch.wex;
+  vector<float>& wey = scratch.wey;
+  vector<float>& w_cross_e = scratch.w_cross_e;
+  wx.resize(num_lines);
+  wy.resize(num_lines);
+  wex.resize(num_lines);
+  wey.resize(num_lines);
+  w_cross_e.resize(num_lines);
+  const float sq_range_max = range_max * range_max;
+  for (size_t i = 0; i < num_poses; ++i) {
+    size_t n = 0;
+    for (size_t k = 0; k < num_lines; ++k) {
+      const float px = p0x[k] - x[i];
+      const float py = p0y[k] - y[i];
+      // Squared distance from the pose to the line.
+      const float sq_length = ex[k] * ex[k] + ey[k] * ey[k];
+      float u = (sq_length > 0) ?
+          -(px * ex[k] + py * ey[k]) / sq_length : 0.0f;
+      u = std::min(1.0f, std::max(0.0f, u));
+      const float qx = px + u * ex[k];
+      const float qy = py + u * ey[k];
+      if (qx * qx + qy * qy > sq_range_max) continue;
+      wx[n] = px;
+      wy[n] = py;
+      wex[n] = ex[k];
+      wey[n] = ey[k];
+      w_cross_e[n] = px * ey[k] - py * ex[k];
+      ++n;
+    }
+    const float* __restrict__ lx = wx.data();
+    const float* __restrict__ ly = wy.data();
+    const float* __restrict__ lex = wex.data();
+    const float* __restrict__ ley = wey.data();
+    const float* __restrict__ lc = w_cross_e.data();
+    const float c = cos(angle[i]);
+    const float s = sin(angle[i]);
+    float* pose_ranges = ranges + i * num_rays;
+    for (int j = 0; j < num_rays; ++j) {
+      const float dx = c * ray_cos[j] - s * ray_sin[j];
+      const float dy = s * ray_cos[j] + c * ray_sin[j];
+      // Solve t d = w + u e for every line. The ray hits the line if u is in
+      // [0, 1] and t is in [range_min, range_max]. Parallel lines give
+      // infinite or NaN parameters, which fail the comparisons. The loop is
+      // written as a chain of selects so that it vectorizes.
+      float best = range_max;
+      #pragma omp simd reduction(min:best)
+      for (size_t k = 0; k < n; ++k) {
+        const float inv_denom = 1.0f / (dx * ley[k] - dy * lex[k]);
+        const float t = lc[k] * inv_denom;
+        const float u = (lx[k] * dy - ly[k] * dx) * inv_denom;
+        float hit_t = (u < 0.0f) ? range_max : t;
+        hit_t = (u > 1.0f) ? range_max : hit_t;
+        hit_t = (t < range_min) ? range_max : hit_t;
+        best = (hit_t < best) ? hit_t : best;
+      }
+      pose_ranges[j] = best;
+    }
   }
-  return false;
 }
 
 void VectorMap::GetPredictedScan(const Vector2f& loc,
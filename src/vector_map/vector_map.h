@@ -19,6 +19,10 @@
 */
 //========================================================================
 
+#include <stdint.h>
+
+#include <algorithm>
+#include <limits>
 #include <string>
 #include <vector>
 
@@ -38,10 +42,46 @@ void TrimOcclusion(const Eigen::Vector2f& loc,
                   geometry::line2f* line2_ptr,
                   std::vector<geometry::line2f>* scene_lines_ptr);
 
+// Uniform grid over the map, where each cell holds the indices of the lines
+// that pass through it. The buckets are stored in compressed row form: the
+// lines of cell i are line_indices[cell_start[i]] up to, but excluding,
+// line_indices[cell_start[i + 1]].
+struct LineGrid {
+  LineGrid() : resolution(0), origin(0, 0), width(0), height(0) {}
+
+  // Bucket the lines into cells of the given size, in meters.
+  void Build(const std::vector<geometry::line2f>& lines, float resolution);
+
+  // Visit the cells traversed by the segment p0 -> p1, in order from p0, with
+  // a DDA walk. For every cell, visit(cell, t_exit) is called, where
+  // t_exit in [0, 1] is the segment parameter at which the walk leaves the
+  // cell. The walk stops early when visit returns true.
+  template <typename CellVisitor>
+  void Traverse(const Eigen::Vector2f& p0,
+                const Eigen::Vector2f& p1,
+                CellVisitor visit) const;
+
+  bool Empty() const { return cell_start.empty(); }
+
+  // Size of a cell, in meters.
+  float resolution;
+  // Location of the corner of cell (0, 0).
+  Eigen::Vector2f origin;
+  // Grid dimensions, in cells.
+  int width;
+  int height;
+  // Offsets into line_indices for each cell, of size width * height + 1.
+  std::vector<uint32_t> cell_start;
+  // Line indices, bucketed by cell.
+  std::vector<uint32_t> line_indices;
+};
+
 struct VectorMap {
   VectorMap() {}
   explicit VectorMap(const std::vector<geometry::line2f>& lines) :
-      lines(lines) {}
+      lines(lines) {
+    BuildIndex();
+  }
   explicit VectorMap(const std::string& file) {
     Load(file);
   }
@@ -69,16 +109,136 @@ struct VectorMap {
                         float angle_max,
                         int num_rays,
                         std::vector<float>* scan);
+  // Predicted ranges for a batch of sensor poses. Pose i is at (x[i], y[i])
+  // facing angle[i], and casts num_rays rays at angles angle_min + j *
+  // angle_increment relative to its heading. Ranges are measured from the
+  // pose, ignore hits closer than range_min, and saturate at range_max. The
+  // range of ray j of pose i is written to ranges[i * num_rays + j]. The map
+  // lines are culled once for the whole batch, so the poses should be close
+  // together, e.g. a particle cloud.
+  void GetPredictedRanges(const float* x,
+                          const float* y,
+                          const float* angle,
+                          size_t num_poses,
+                          float range_min,
+                          float range_max,
+                          float angle_min,
+                          float angle_increment,
+                          int num_rays,
+                          float* ranges) const;
+  // As above, with ray j cast at ray_angles[j] relative to the heading.
+  void GetPredictedRanges(const float* x,
+                          const float* y,
+                          const float* angle,
+                          size_t num_poses,
+                          float range_min,
+                          float range_max,
+                          const float* ray_angles,
+                          int num_rays,
+                          float* ranges) const;
+  // As above, with ray j cast along the unit vector (ray_cos[j], ray_sin[j])
+  // relative to the heading, e.g. from a scan_geometry::BeamDirections table.
+  void GetPredictedRanges(const float* x,
+                          const float* y,
+                          const float* angle,
+                          size_t num_poses,
+                          float range_min,
+                          float range_max,
+                          const float* ray_cos,
+                          const float* ray_sin,
+                          int num_rays,
+                          float* ranges) const;
+
+  // Indices of the lines that overlap the axis-aligned box, in map order.
+  void GetLinesInBox(const Eigen::Vector2f& box_min,
+                     const Eigen::Vector2f& box_max,
+                     std::vector<uint32_t>* indices) const;
+
   void Cleanup();
 
   void Load(const std::string& file);
 
+  // Write the cleaned up lines and their index to a cache file, see
+  // map_cache.h, or read them back as loaded from file, skipping Cleanup.
+  // Return false on failure; a failed load leaves the map unchanged.
+  bool SaveCache(const std::string& cache_file) const;
+  bool LoadCache(const std::string& cache_file, const std::string& file);
+
+  // Rebuild the spatial index over lines. Called by Load.
+  void BuildIndex();
+
   bool Intersects(const Eigen::Vector2f& v0, const Eigen::Vector2f& v1) const ;
+
+  // Find the intersection of the segment p0 -> p1 with the map that is closest
+  // to p0. Returns the index of the intersecting line and sets *intersection,
+  // or returns -1 if there is no intersection.
+  int GetClosestIntersection(const Eigen::Vector2f& p0,
+                             const Eigen::Vector2f& p1,
+                             Eigen::Vector2f* intersection) const;
+
   std::vector<geometry::line2f> lines;
   std::string file_name;
+  // Spatial index over lines.
+  LineGrid grid;
 };
 
-
+template <typename CellVisitor>
+void LineGrid::Traverse(const Eigen::Vector2f& p0,
+                        const Eigen::Vector2f& p1,
+                        CellVisitor visit) const {
+  if (Empty()) return;
+  const Eigen::Vector2f d = p1 - p0;
+  // Clip the segment to the grid bounds (Liang-Barsky).
+  float t0 = 0;
+  float t1 = 1;
+  const Eigen::Vector2f lo = origin;
+  const Eigen::Vector2f hi =
+      origin + resolution * Eigen::Vector2f(width, height);
+  for (int a = 0; a < 2; ++a) {
+    if (d[a] == 0.0f) {
+      if (p0[a] < lo[a] || p0[a] > hi[a]) return;
+      continue;
+    }
+    float ta = (lo[a] - p0[a]) / d[a];
+    float tb = (hi[a] - p0[a]) / d[a];
+    if (ta > tb) std::swap(ta, tb);
+    t0 = std::max(t0, ta);
+    t1 = std::min(t1, tb);
+    if (t0 > t1) return;
+  }
+  const Eigen::Vector2f start = p0 + t0 * d;
+  int cell[2];
+  int step[2];
+  float t_max[2];
+  float t_delta[2];
+  const int size[2] = {width, height};
+  for (int a = 0; a < 2; ++a) {
+    cell[a] = static_cast<int>((start[a] - origin[a]) / resolution);
+    cell[a] = std::min(std::max(cell[a], 0), size[a] - 1);
+    if (d[a] > 0.0f) {
+      step[a] = 1;
+      t_max[a] = (origin[a] + (cell[a] + 1) * resolution - p0[a]) / d[a];
+      t_delta[a] = resolution / d[a];
+    } else if (d[a] < 0.0f) {
+      step[a] = -1;
+      t_max[a] = (origin[a] + cell[a] * resolution - p0[a]) / d[a];
+      t_delta[a] = -resolution / d[a];
+    } else {
+      step[a] = 0;
+      t_max[a] = std::numeric_limits<float>::infinity();
+      t_delta[a] = std::numeric_limits<float>::infinity();
+    }
+  }
+  while (true) {
+    const int a = (t_max[0] < t_max[1]) ? 0 : 1;
+    const float t_exit = std::min(t_max[a], t1);
+    if (visit(cell[1] * width + cell[0], t_exit)) return;
+    if (t_max[a] >= t1) return;
+    cell[a] += step[a];
+    if (cell[a] < 0 || cell[a] >= size[a]) return;
+    t_max[a] += t_delta[a];
+  }
+}
 
 }  // namespace vector_map
 